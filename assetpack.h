@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2020 gyabo <gyaboyan@gmail.com>
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+#pragma once
+
+//
+// Asset pack : header, table of contents and StagingAlign aligned blobs.
+// The file is mapped read only and a blob pointer goes straight to
+// upload_user_image, which copies it into the staging ring.
+// Written by assetpack_tool.cpp.
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "bccodec.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif //_WIN32
+
+struct assetpack_t {
+	static constexpr uint32_t Magic = 0x504E4254; //"TBNP"
+	static constexpr uint32_t Version = 1;
+	static constexpr uint64_t BlobAlign = 256;
+
+	//the VkFormat values a blob may have, without including vulkan.h here.
+	static constexpr uint32_t FormatRGBA8 = 37; //VK_FORMAT_R8G8B8A8_UNORM
+	static constexpr uint32_t FormatBC1 = 133; //VK_FORMAT_BC1_RGBA_UNORM_BLOCK
+	static constexpr uint32_t FormatBC3 = 137; //VK_FORMAT_BC3_UNORM_BLOCK
+	static constexpr uint32_t FormatBC7 = 145; //VK_FORMAT_BC7_UNORM_BLOCK
+
+	struct header_t {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t entry_count;
+		uint32_t reserved;
+		uint64_t toc_offset;
+		uint64_t file_size;
+	};
+
+	//format is the VkFormat value of the blob.
+	struct entry_t {
+		char name[48];
+		uint32_t width;
+		uint32_t height;
+		uint32_t format;
+		uint32_t reserved;
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	const uint8_t *base = nullptr;
+	uint64_t size = 0;
+	const header_t *header = nullptr;
+	const entry_t *entries = nullptr;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#else
+	int fd = -1;
+#endif //_WIN32
+
+	~assetpack_t()
+	{
+		close();
+	}
+
+	bool open(const char *path)
+	{
+		close();
+#ifdef _WIN32
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return (false);
+		LARGE_INTEGER file_size = {};
+		GetFileSizeEx(file, &file_size);
+		size = file_size.QuadPart;
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping)
+			base = (const uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+		fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return (false);
+		struct stat st = {};
+		fstat(fd, &st);
+		size = st.st_size;
+		void *addr = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+		if (addr != MAP_FAILED)
+			base = (const uint8_t *)addr;
+#endif //_WIN32
+		if (!base || !validate()) {
+			printf("assetpack : invalid file %s\n", path);
+			close();
+			return (false);
+		}
+		return (true);
+	}
+
+	//bytes upload_user_image reads for the entry, 0 for an unknown format or size.
+	static uint64_t get_image_bytes(const entry_t & e)
+	{
+		if (e.width == 0 || e.height == 0)
+			return (0);
+		if (e.format == FormatRGBA8)
+			return (uint64_t(e.width) * e.height * 4);
+		if (e.format == FormatBC1)
+			return (bc_image_bytes(BC_FORMAT_BC1, e.width, e.height));
+		if (e.format == FormatBC3)
+			return (bc_image_bytes(BC_FORMAT_BC3, e.width, e.height));
+		if (e.format == FormatBC7)
+			return (bc_image_bytes(BC_FORMAT_BC7, e.width, e.height));
+		return (0);
+	}
+
+	//every offset and read length is checked once, the accessors trust the table afterwards.
+	bool validate()
+	{
+		if (size < sizeof(header_t))
+			return (false);
+		header = (const header_t *)base;
+		if (header->magic != Magic || header->version != Version || header->file_size != size)
+			return (false);
+		uint64_t toc_bytes = uint64_t(header->entry_count) * sizeof(entry_t);
+		if (header->toc_offset > size || toc_bytes > size - header->toc_offset)
+			return (false);
+		entries = (const entry_t *)(base + header->toc_offset);
+		for (uint32_t i = 0 ; i < header->entry_count; i++) {
+			auto & e = entries[i];
+			if (e.offset > size || e.size > size - e.offset || e.name[sizeof(e.name) - 1] != 0)
+				return (false);
+			uint64_t image_bytes = get_image_bytes(e);
+			if (image_bytes == 0 || e.size < image_bytes)
+				return (false);
+		}
+		return (true);
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (base)
+			UnmapViewOfFile(base);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (base)
+			munmap((void *)base, size);
+		if (fd >= 0)
+			::close(fd);
+		fd = -1;
+#endif //_WIN32
+		base = nullptr;
+		size = 0;
+		header = nullptr;
+		entries = nullptr;
+	}
+
+	uint32_t count() const
+	{
+		return header ? header->entry_count : 0;
+	}
+
+	const entry_t *find(const char *name) const
+	{
+		for (uint32_t i = 0 ; i < count(); i++)
+			if (strcmp(entries[i].name, name) == 0)
+				return &entries[i];
+		return nullptr;
+	}
+
+	const void *data(const entry_t & e) const
+	{
+		return base + e.offset;
+	}
+};
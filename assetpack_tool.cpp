@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2020 gyabo <gyaboyan@gmail.com>
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// Offline packer for assetpack.h.
+// usage : assetpack_tool out.pack [-bgra] [-rgba8|-bc1|-bc3|-bc7] name=file.raw:WxH ...
+// inputs are raw 32 bit texels, -bgra swaps the ffmpeg rgb32 output of
+// bat/converttex.bat. the options apply to the inputs after them.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "assetpack.h"
+#include "bccodec.h"
+
+static bool
+read_file(const std::string & path, std::vector<uint8_t> & dst)
+{
+	FILE *fp = fopen(path.c_str(), "rb");
+	if (!fp)
+		return (false);
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	dst.resize(size > 0 ? size : 0);
+	size_t read_size = dst.empty() ? 0 : fread(dst.data(), 1, dst.size(), fp);
+	fclose(fp);
+	return (read_size == dst.size());
+}
+
+static bool
+write_bytes(FILE *fp, const void *src, size_t size)
+{
+	return (size == 0 || fwrite(src, 1, size, fp) == size);
+}
+
+static bool
+write_padding(FILE *fp, uint64_t & offset)
+{
+	static const uint8_t zero[assetpack_t::BlobAlign] = {};
+	uint64_t pad = (assetpack_t::BlobAlign - offset % assetpack_t::BlobAlign) % assetpack_t::BlobAlign;
+	offset += pad;
+	return (write_bytes(fp, zero, pad));
+}
+
+//no partial pack is left behind.
+static int
+fail(FILE *fp, const char *path)
+{
+	fclose(fp);
+	remove(path);
+	return (1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	if (argc < 3) {
+		printf("usage : %s out.pack [-bgra] [-rgba8|-bc1|-bc3|-bc7] name=file.raw:WxH ...\n", argv[0]);
+		return (1);
+	}
+	FILE *fp = fopen(argv[1], "wb");
+	if (!fp) {
+		printf("failed open : %s\n", argv[1]);
+		return (1);
+	}
+
+	bool is_bgra = false;
+	uint32_t format = assetpack_t::FormatRGBA8;
+	uint32_t bc_format = UINT32_MAX;
+	std::vector<assetpack_t::entry_t> entries;
+	assetpack_t::header_t header = {};
+	uint64_t offset = sizeof(header);
+	if (!write_bytes(fp, &header, sizeof(header))) {
+		printf("failed write : %s\n", argv[1]);
+		return (fail(fp, argv[1]));
+	}
+
+	for (int i = 2 ; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "-bgra") {
+			is_bgra = true;
+			continue;
+		}
+		if (arg == "-rgba8" || arg == "-bc1" || arg == "-bc3" || arg == "-bc7") {
+			format = assetpack_t::FormatRGBA8;
+			bc_format = UINT32_MAX;
+			if (arg == "-bc1") {
+				format = assetpack_t::FormatBC1;
+				bc_format = BC_FORMAT_BC1;
+			}
+			if (arg == "-bc3") {
+				format = assetpack_t::FormatBC3;
+				bc_format = BC_FORMAT_BC3;
+			}
+			if (arg == "-bc7") {
+				format = assetpack_t::FormatBC7;
+				bc_format = BC_FORMAT_BC7;
+			}
+			continue;
+		}
+
+		//name=file.raw:WxH
+		auto eq = arg.find('=');
+		auto colon = arg.rfind(':');
+		uint32_t width = 0;
+		uint32_t height = 0;
+		if (eq == std::string::npos || colon == std::string::npos || colon < eq ||
+			sscanf(arg.c_str() + colon + 1, "%ux%u", &width, &height) != 2) {
+			printf("bad input : %s\n", arg.c_str());
+			return (fail(fp, argv[1]));
+		}
+		std::string name = arg.substr(0, eq);
+		std::string path = arg.substr(eq + 1, colon - eq - 1);
+		std::vector<uint8_t> raw;
+		if (!read_file(path, raw) || raw.size() < uint64_t(width) * height * 4) {
+			printf("failed read : %s\n", path.c_str());
+			return (fail(fp, argv[1]));
+		}
+		if (name.size() >= sizeof(assetpack_t::entry_t::name)) {
+			printf("name too long : %s\n", name.c_str());
+			return (fail(fp, argv[1]));
+		}
+		if (is_bgra)
+			for (uint64_t t = 0 ; t < uint64_t(width) * height; t++)
+				std::swap(raw[t * 4 + 0], raw[t * 4 + 2]);
+
+		std::vector<uint8_t> blob;
+		if (bc_format != UINT32_MAX) {
+			blob.resize(bc_image_bytes(bc_format, width, height));
+			bc_encode_image(bc_format, width, height, (const uint32_t *)raw.data(), blob.data());
+		} else {
+			blob.assign(raw.begin(), raw.begin() + uint64_t(width) * height * 4);
+		}
+
+		assetpack_t::entry_t e = {};
+		strcpy(e.name, name.c_str());
+		e.width = width;
+		e.height = height;
+		e.format = format;
+		bool is_written = write_padding(fp, offset);
+		e.offset = offset;
+		e.size = blob.size();
+		if (!is_written || !write_bytes(fp, blob.data(), blob.size())) {
+			printf("failed write : %s\n", argv[1]);
+			return (fail(fp, argv[1]));
+		}
+		offset += blob.size();
+		entries.push_back(e);
+		printf("%s : %ux%u format=%u %llu bytes\n", e.name, width, height, format, (unsigned long long)e.size);
+	}
+
+	bool is_written = write_padding(fp, offset);
+	header.magic = assetpack_t::Magic;
+	header.version = assetpack_t::Version;
+	header.entry_count = entries.size();
+	header.toc_offset = offset;
+	is_written = is_written && write_bytes(fp, entries.data(), sizeof(assetpack_t::entry_t) * entries.size());
+	header.file_size = offset + sizeof(assetpack_t::entry_t) * entries.size();
+	is_written = is_written && fseek(fp, 0, SEEK_SET) == 0;
+	is_written = is_written && write_bytes(fp, &header, sizeof(header));
+	if (!is_written) {
+		printf("failed write : %s\n", argv[1]);
+		return (fail(fp, argv[1]));
+	}
+	if (fclose(fp) != 0) {
+		printf("failed write : %s\n", argv[1]);
+		remove(argv[1]);
+		return (1);
+	}
+
+	return (0);
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2020 gyabo <gyaboyan@gmail.com>
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <string.h>
+#include <vector>
+
+//skyline bottom-left packer, one per atlas page.
+struct atlas_packer_t {
+	struct segment_t {
+		uint32_t x;
+		uint32_t y;
+		uint32_t w;
+	};
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<segment_t> skyline;
+
+	void init(uint32_t w, uint32_t h)
+	{
+		width = w;
+		height = h;
+		skyline.clear();
+		skyline.push_back({0, 0, w});
+	}
+
+	//top of the skyline under [x, x + w) starting at segment index, UINT32_MAX if it does not fit.
+	uint32_t fit(size_t index, uint32_t w, uint32_t h)
+	{
+		uint32_t x = skyline[index].x;
+		uint32_t y = 0;
+		uint32_t rest = w;
+		if (x + w > width)
+			return UINT32_MAX;
+		for (size_t i = index ; rest > 0; i++) {
+			if (i >= skyline.size())
+				return UINT32_MAX;
+			y = std::max(y, skyline[i].y);
+			rest -= std::min(rest, skyline[i].w);
+		}
+		if (y + h > height)
+			return UINT32_MAX;
+		return (y);
+	}
+
+	bool insert(uint32_t w, uint32_t h, uint32_t & out_x, uint32_t & out_y)
+	{
+		size_t best_index = SIZE_MAX;
+		uint32_t best_top = UINT32_MAX;
+		uint32_t best_w = UINT32_MAX;
+
+		//lowest top first, then the narrowest segment.
+		for (size_t i = 0 ; i < skyline.size(); i++) {
+			uint32_t y = fit(i, w, h);
+			if (y == UINT32_MAX)
+				continue;
+			if (y + h < best_top || (y + h == best_top && skyline[i].w < best_w)) {
+				best_index = i;
+				best_top = y + h;
+				best_w = skyline[i].w;
+			}
+		}
+		if (best_index == SIZE_MAX)
+			return (false);
+
+		out_x = skyline[best_index].x;
+		out_y = best_top - h;
+		segment_t seg = {out_x, best_top, w};
+		skyline.insert(skyline.begin() + best_index, seg);
+
+		//cut the segments now under the new one.
+		for (size_t i = best_index + 1 ; i < skyline.size(); ) {
+			auto & s = skyline[i];
+			uint32_t right = seg.x + seg.w;
+			if (s.x >= right)
+				break;
+			uint32_t shrink = std::min(s.w, right - s.x);
+			s.x += shrink;
+			s.w -= shrink;
+			if (s.w == 0)
+				skyline.erase(skyline.begin() + i);
+			else
+				break;
+		}
+
+		//merge the neighbours of the same height.
+		for (size_t i = 0 ; i + 1 < skyline.size(); ) {
+			if (skyline[i].y == skyline[i + 1].y) {
+				skyline[i].w += skyline[i + 1].w;
+				skyline.erase(skyline.begin() + i + 1);
+			} else {
+				i++;
+			}
+		}
+		return (true);
+	}
+};
+
+//packs many small RGBA8 images into a few user image slots (pages).
+struct atlas_t {
+	//matid and uvinfo of an object, uvinfo keeps the grid encoding of the shaders :
+	//uv = (corner + uvinfo.xy) / uvinfo.zw
+	struct handle_t {
+		uint32_t matid = 0;
+		float uvinfo[4] = {0, 0, 1, 1};
+
+		template<typename T>
+		void apply(T & obj) const
+		{
+			obj.metadata[1] = matid;
+			memcpy(obj.uvinfo, uvinfo, sizeof(uvinfo));
+		}
+	};
+
+	struct page_t {
+		atlas_packer_t packer;
+		std::vector<uint32_t> texels;
+		bool is_dirty = false;
+	};
+
+	uint32_t page_size = 0;
+	uint32_t first_slot = 0;
+	uint32_t page_max = 0;
+	uint32_t padding = 0;
+	std::vector<page_t> pages;
+
+	//pages use the user image slots [slot, slot + count).
+	void init(uint32_t size, uint32_t slot, uint32_t count, uint32_t pad = 1)
+	{
+		page_size = size;
+		first_slot = slot;
+		page_max = count;
+		padding = pad;
+		pages.clear();
+	}
+
+	bool add(uint32_t width, uint32_t height, const uint32_t *src, handle_t & handle)
+	{
+		uint32_t w = width + padding * 2;
+		uint32_t h = height + padding * 2;
+		uint32_t x = 0;
+		uint32_t y = 0;
+		if (width == 0 || height == 0 || w > page_size || h > page_size)
+			return (false);
+
+		size_t page_index = 0;
+		for ( ; page_index < pages.size(); page_index++)
+			if (pages[page_index].packer.insert(w, h, x, y))
+				break;
+		if (page_index == pages.size()) {
+			if (pages.size() >= page_max)
+				return (false);
+			pages.emplace_back();
+			auto & page = pages.back();
+			page.packer.init(page_size, page_size);
+			page.texels.resize(page_size * page_size);
+			page.packer.insert(w, h, x, y);
+		}
+		auto & page = pages[page_index];
+
+		//the border repeats the edge texels so filtering does not bleed.
+		for (uint32_t dy = 0 ; dy < h; dy++) {
+			uint32_t sy = std::min(std::max(dy, padding) - padding, height - 1);
+			for (uint32_t dx = 0 ; dx < w; dx++) {
+				uint32_t sx = std::min(std::max(dx, padding) - padding, width - 1);
+				page.texels[(y + dy) * page_size + (x + dx)] = src[sy * width + sx];
+			}
+		}
+		page.is_dirty = true;
+
+		handle.matid = first_slot + page_index;
+		handle.uvinfo[2] = float(page_size) / float(width);
+		handle.uvinfo[3] = float(page_size) / float(height);
+		handle.uvinfo[0] = float(x + padding) / float(width);
+		handle.uvinfo[1] = float(y + padding) / float(height);
+		return (true);
+	}
+
+	//works with vkcontext_t and cpucontext_t.
+	//is_all : every page, to fill a second context with the same atlas.
+	template<typename T>
+	void upload(T & ctx, bool is_all = false)
+	{
+		for (uint32_t i = 0 ; i < pages.size(); i++) {
+			auto & page = pages[i];
+			if (!page.is_dirty && !is_all)
+				continue;
+			ctx.upload_user_image(first_slot + i, page_size, page_size, page.texels.data());
+			page.is_dirty = false;
+		}
+	}
+};
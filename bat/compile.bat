@@ -3,3 +3,7 @@ glslangValidator -V -S vert --D _VS_ shaders/draw_rect.glsl -o draw_rect.glsl_VS
 glslangValidator -V -S frag --D _PS_ shaders/draw_rect.glsl -o draw_rect.glsl_PS_temp.spv
 glslangValidator -V -S vert --D _VS_ shaders/present.glsl -o present.glsl_VS_temp.spv
 glslangValidator -V -S frag --D _PS_ shaders/present.glsl -o present.glsl_PS_temp.spv
+glslangValidator -V -S vert --D _VS_ shaders/draw_object.glsl -o draw_object.glsl_VS_temp.spv
+glslangValidator -V -S comp --D _CS_ shaders/sort_objects.glsl -o sort_objects.glsl_CS_temp.spv
+glslangValidator -V -S comp --D _CS_ shaders/mip_generate.glsl -o mip_generate.glsl_CS_temp.spv
+glslangValidator -V -S comp --D _CS_ shaders/composite.glsl -o composite.glsl_CS_temp.spv
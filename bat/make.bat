@@ -1 +1,4 @@
 cl main.cpp /EHsc /Ox /GS- /std:c++latest /nologo 
+cl assetpack_tool.cpp /EHsc /Ox /GS- /std:c++latest /nologo
+cl expand_check.cpp /EHsc /Ox /GS- /arch:AVX2 /std:c++latest /nologo
+cl cpu_check.cpp /EHsc /Ox /GS- /arch:AVX2 /std:c++latest /nologo
@@ -0,0 +1,617 @@
+/*
+ * Copyright (c) 2020 gyabo <gyaboyan@gmail.com>
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+#pragma once
+
+//
+// Block compression of RGBA8 user images, see upload_user_image.
+// BC1 and the color of BC3 use the principal axis of the block plus one
+// least squares refinement, the alpha of BC3 is min / max (BC4) and BC7
+// writes mode 6 only (one subset, RGBA 7.7.7.7 + p-bit, 4 bit indices).
+// The decoders are for verification, the BC7 one reads mode 6 only.
+// The index search is SSE2 when available, images are split by block rows
+// over threads.
+//
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif //__SSE2__
+
+enum {
+	BC_FORMAT_BC1,
+	BC_FORMAT_BC3,
+	BC_FORMAT_BC7,
+};
+
+inline uint32_t
+bc_block_bytes(uint32_t format)
+{
+	return format == BC_FORMAT_BC1 ? 8 : 16;
+}
+
+inline uint64_t
+bc_image_bytes(uint32_t format, uint32_t width, uint32_t height)
+{
+	return uint64_t((width + 3) / 4) * ((height + 3) / 4) * bc_block_bytes(format);
+}
+
+//nearest palette entry of every texel, returns the summed squared error.
+inline uint32_t
+bc_select_indices_ref(
+	const uint8_t texels[16][4],
+	const uint8_t palette[][4],
+	uint32_t palette_count,
+	bool is_alpha,
+	uint8_t indices[16])
+{
+	uint32_t ret = 0;
+	uint32_t channels = is_alpha ? 4 : 3;
+	for (uint32_t i = 0 ; i < 16; i++) {
+		uint32_t best = UINT32_MAX;
+		for (uint32_t j = 0 ; j < palette_count; j++) {
+			uint32_t d = 0;
+			for (uint32_t c = 0 ; c < channels; c++) {
+				int32_t diff = int32_t(texels[i][c]) - int32_t(palette[j][c]);
+				d += diff * diff;
+			}
+			if (d < best) {
+				best = d;
+				indices[i] = j;
+			}
+		}
+		ret += best;
+	}
+	return (ret);
+}
+
+#ifdef __SSE2__
+//squared distance of 4 texels to one color, 16 bit differences through madd.
+inline __m128i
+bc_distance4_sse2(__m128i texels, __m128i color)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i dlo = _mm_sub_epi16(_mm_unpacklo_epi8(texels, zero), color);
+	__m128i dhi = _mm_sub_epi16(_mm_unpackhi_epi8(texels, zero), color);
+	__m128 slo = _mm_castsi128_ps(_mm_madd_epi16(dlo, dlo));
+	__m128 shi = _mm_castsi128_ps(_mm_madd_epi16(dhi, dhi));
+	__m128i even = _mm_castps_si128(_mm_shuffle_ps(slo, shi, _MM_SHUFFLE(2, 0, 2, 0)));
+	__m128i odd = _mm_castps_si128(_mm_shuffle_ps(slo, shi, _MM_SHUFFLE(3, 1, 3, 1)));
+	return _mm_add_epi32(even, odd);
+}
+
+inline uint32_t
+bc_select_indices_sse2(
+	const uint8_t texels[16][4],
+	const uint8_t palette[][4],
+	uint32_t palette_count,
+	bool is_alpha,
+	uint8_t indices[16])
+{
+	__m128i mask = _mm_set1_epi32(is_alpha ? -1 : 0x00FFFFFF);
+	__m128i t[4];
+	__m128i best[4];
+	__m128i best_index[4];
+	for (uint32_t i = 0 ; i < 4; i++) {
+		t[i] = _mm_and_si128(_mm_loadu_si128((const __m128i *)texels[i * 4]), mask);
+		best[i] = _mm_set1_epi32(0x7FFFFFFF);
+		best_index[i] = _mm_setzero_si128();
+	}
+	for (uint32_t j = 0 ; j < palette_count; j++) {
+		const uint8_t *p = palette[j];
+		__m128i color = _mm_set_epi16(
+				is_alpha ? p[3] : 0, p[2], p[1], p[0],
+				is_alpha ? p[3] : 0, p[2], p[1], p[0]);
+		__m128i index = _mm_set1_epi32(j);
+		for (uint32_t i = 0 ; i < 4; i++) {
+			__m128i d = bc_distance4_sse2(t[i], color);
+			__m128i is_less = _mm_cmplt_epi32(d, best[i]);
+			best[i] = _mm_or_si128(_mm_and_si128(is_less, d), _mm_andnot_si128(is_less, best[i]));
+			best_index[i] = _mm_or_si128(_mm_and_si128(is_less, index), _mm_andnot_si128(is_less, best_index[i]));
+		}
+	}
+
+	uint32_t ret = 0;
+	for (uint32_t i = 0 ; i < 4; i++) {
+		alignas(16) uint32_t d[4];
+		alignas(16) uint32_t index[4];
+		_mm_store_si128((__m128i *)d, best[i]);
+		_mm_store_si128((__m128i *)index, best_index[i]);
+		for (uint32_t k = 0 ; k < 4; k++) {
+			ret += d[k];
+			indices[i * 4 + k] = index[k];
+		}
+	}
+	return (ret);
+}
+#endif //__SSE2__
+
+inline uint32_t
+bc_select_indices(
+	const uint8_t texels[16][4],
+	const uint8_t palette[][4],
+	uint32_t palette_count,
+	bool is_alpha,
+	uint8_t indices[16])
+{
+#ifdef __SSE2__
+	return bc_select_indices_sse2(texels, palette, palette_count, is_alpha, indices);
+#else
+	return bc_select_indices_ref(texels, palette, palette_count, is_alpha, indices);
+#endif //__SSE2__
+}
+
+//principal axis of the first channels, returns the mean and the projected range.
+inline void
+bc_principal_axis(
+	const uint8_t texels[16][4],
+	uint32_t channels,
+	float mean[4],
+	float axis[4],
+	float & tmin,
+	float & tmax)
+{
+	float cov[4][4] = {};
+	for (uint32_t c = 0 ; c < channels; c++) {
+		mean[c] = 0;
+		for (uint32_t i = 0 ; i < 16; i++)
+			mean[c] += texels[i][c];
+		mean[c] /= 16.0f;
+	}
+	for (uint32_t i = 0 ; i < 16; i++)
+		for (uint32_t a = 0 ; a < channels; a++)
+			for (uint32_t b = 0 ; b < channels; b++)
+				cov[a][b] += (texels[i][a] - mean[a]) * (texels[i][b] - mean[b]);
+
+	//power iteration, starting from the largest diagonal.
+	uint32_t start = 0;
+	for (uint32_t c = 1 ; c < channels; c++)
+		if (cov[c][c] > cov[start][start])
+			start = c;
+	for (uint32_t c = 0 ; c < channels; c++)
+		axis[c] = c == start ? 1.0f : 0.0f;
+	for (uint32_t n = 0 ; n < 8; n++) {
+		float next[4] = {};
+		float len = 0;
+		for (uint32_t a = 0 ; a < channels; a++) {
+			for (uint32_t b = 0 ; b < channels; b++)
+				next[a] += cov[a][b] * axis[b];
+			len += next[a] * next[a];
+		}
+		if (len < 1e-12f)
+			break;
+		len = 1.0f / sqrtf(len);
+		for (uint32_t c = 0 ; c < channels; c++)
+			axis[c] = next[c] * len;
+	}
+
+	tmin = FLT_MAX;
+	tmax = -FLT_MAX;
+	for (uint32_t i = 0 ; i < 16; i++) {
+		float t = 0;
+		for (uint32_t c = 0 ; c < channels; c++)
+			t += (texels[i][c] - mean[c]) * axis[c];
+		tmin = std::min(tmin, t);
+		tmax = std::max(tmax, t);
+	}
+}
+
+inline uint8_t
+bc_clamp_u8(float v)
+{
+	return (uint8_t)std::min(std::max(v + 0.5f, 0.0f), 255.0f);
+}
+
+inline uint16_t
+bc_pack_565(const float c[3])
+{
+	uint32_t r = (uint32_t)std::min(std::max(c[0] * 31.0f / 255.0f + 0.5f, 0.0f), 31.0f);
+	uint32_t g = (uint32_t)std::min(std::max(c[1] * 63.0f / 255.0f + 0.5f, 0.0f), 63.0f);
+	uint32_t b = (uint32_t)std::min(std::max(c[2] * 31.0f / 255.0f + 0.5f, 0.0f), 31.0f);
+	return (r << 11) | (g << 5) | b;
+}
+
+inline void
+bc_unpack_565(uint16_t v, uint8_t c[4])
+{
+	uint32_t r = (v >> 11) & 31;
+	uint32_t g = (v >> 5) & 63;
+	uint32_t b = v & 31;
+	c[0] = (r << 3) | (r >> 2);
+	c[1] = (g << 2) | (g >> 4);
+	c[2] = (b << 3) | (b >> 2);
+	c[3] = 255;
+}
+
+//4 color mode : c0, c1, 2/3 c0 + 1/3 c1, 1/3 c0 + 2/3 c1.
+inline void
+bc1_palette(uint16_t c0, uint16_t c1, uint8_t palette[4][4])
+{
+	bc_unpack_565(c0, palette[0]);
+	bc_unpack_565(c1, palette[1]);
+	for (uint32_t c = 0 ; c < 4; c++) {
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+	}
+}
+
+inline uint32_t
+bc1_try_endpoints(const uint8_t texels[16][4], uint16_t c0, uint16_t c1, uint8_t indices[16])
+{
+	uint8_t palette[4][4];
+	bc1_palette(c0, c1, palette);
+	return bc_select_indices(texels, palette, 4, false, indices);
+}
+
+//color part of BC1 and BC3, always 4 color mode.
+inline void
+bc1_encode_color(const uint8_t texels[16][4], uint8_t *dst)
+{
+	float mean[4];
+	float axis[4];
+	float tmin = 0;
+	float tmax = 0;
+	bc_principal_axis(texels, 3, mean, axis, tmin, tmax);
+	float e0[3];
+	float e1[3];
+	for (uint32_t c = 0 ; c < 3; c++) {
+		e0[c] = mean[c] + axis[c] * tmax;
+		e1[c] = mean[c] + axis[c] * tmin;
+	}
+	uint16_t c0 = bc_pack_565(e0);
+	uint16_t c1 = bc_pack_565(e1);
+	uint8_t indices[16];
+	uint32_t err = bc1_try_endpoints(texels, c0, c1, indices);
+
+	//least squares endpoints for the chosen indices, kept when better.
+	static const float weights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+	float aa = 0, ab = 0, bb = 0;
+	float ax[3] = {}, bx[3] = {};
+	for (uint32_t i = 0 ; i < 16; i++) {
+		float a = weights[indices[i]];
+		float b = 1.0f - a;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (uint32_t c = 0 ; c < 3; c++) {
+			ax[c] += a * texels[i][c];
+			bx[c] += b * texels[i][c];
+		}
+	}
+	float det = aa * bb - ab * ab;
+	if (fabsf(det) > 1e-6f) {
+		for (uint32_t c = 0 ; c < 3; c++) {
+			e0[c] = (ax[c] * bb - bx[c] * ab) / det;
+			e1[c] = (bx[c] * aa - ax[c] * ab) / det;
+		}
+		uint16_t ls0 = bc_pack_565(e0);
+		uint16_t ls1 = bc_pack_565(e1);
+		uint8_t ls_indices[16];
+		uint32_t ls_err = bc1_try_endpoints(texels, ls0, ls1, ls_indices);
+		if (ls_err < err) {
+			c0 = ls0;
+			c1 = ls1;
+			memcpy(indices, ls_indices, sizeof(indices));
+		}
+	}
+
+	//c0 > c1 selects the 4 color mode.
+	static const uint8_t swap_index[4] = {1, 0, 3, 2};
+	if (c0 < c1) {
+		std::swap(c0, c1);
+		for (auto & index : indices)
+			index = swap_index[index];
+	}
+	uint32_t bits = 0;
+	for (uint32_t i = 0 ; i < 16; i++)
+		bits |= uint32_t(c0 == c1 ? 0 : indices[i]) << (i * 2);
+	dst[0] = c0 & 0xFF;
+	dst[1] = c0 >> 8;
+	dst[2] = c1 & 0xFF;
+	dst[3] = c1 >> 8;
+	memcpy(dst + 4, &bits, sizeof(bits));
+}
+
+//a0 > a1 : a0, a1 and 6 steps between them.
+inline void
+bc4_palette(uint8_t a0, uint8_t a1, uint8_t palette[8])
+{
+	palette[0] = a0;
+	palette[1] = a1;
+	if (a0 > a1) {
+		for (uint32_t i = 2 ; i < 8; i++)
+			palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+	} else {
+		for (uint32_t i = 2 ; i < 6; i++)
+			palette[i] = ((6 - i) * a0 + (i - 1) * a1) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+inline void
+bc4_encode_alpha(const uint8_t texels[16][4], uint8_t *dst)
+{
+	uint8_t a0 = 0;
+	uint8_t a1 = 255;
+	for (uint32_t i = 0 ; i < 16; i++) {
+		a0 = std::max(a0, texels[i][3]);
+		a1 = std::min(a1, texels[i][3]);
+	}
+	uint8_t palette[8];
+	bc4_palette(a0, a1, palette);
+	uint64_t bits = 0;
+	for (uint32_t i = 0 ; i < 16 && a0 != a1; i++) {
+		uint32_t best = UINT32_MAX;
+		uint32_t best_index = 0;
+		for (uint32_t j = 0 ; j < 8; j++) {
+			uint32_t d = abs(int32_t(texels[i][3]) - int32_t(palette[j]));
+			if (d < best) {
+				best = d;
+				best_index = j;
+			}
+		}
+		bits |= uint64_t(best_index) << (i * 3);
+	}
+	dst[0] = a0;
+	dst[1] = a1;
+	for (uint32_t i = 0 ; i < 6; i++)
+		dst[2 + i] = (bits >> (i * 8)) & 0xFF;
+}
+
+inline void
+bc_put_bits(uint8_t *dst, uint32_t & pos, uint32_t value, uint32_t count)
+{
+	for (uint32_t i = 0 ; i < count; i++, pos++)
+		if ((value >> i) & 1)
+			dst[pos / 8] |= 1 << (pos % 8);
+}
+
+inline uint32_t
+bc_get_bits(const uint8_t *src, uint32_t & pos, uint32_t count)
+{
+	uint32_t ret = 0;
+	for (uint32_t i = 0 ; i < count; i++, pos++)
+		ret |= uint32_t((src[pos / 8] >> (pos % 8)) & 1) << i;
+	return (ret);
+}
+
+static const uint8_t bc7_weights4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+inline void
+bc7_palette(const uint8_t e0[4], const uint8_t e1[4], uint8_t palette[16][4])
+{
+	for (uint32_t i = 0 ; i < 16; i++)
+		for (uint32_t c = 0 ; c < 4; c++)
+			palette[i][c] = ((64 - bc7_weights4[i]) * e0[c] + bc7_weights4[i] * e1[c] + 32) >> 6;
+}
+
+//mode 6 : endpoints are 7 bits per channel plus one shared p-bit each.
+inline void
+bc7_encode_block(const uint8_t texels[16][4], uint8_t *dst)
+{
+	float mean[4];
+	float axis[4];
+	float tmin = 0;
+	float tmax = 0;
+	bc_principal_axis(texels, 4, mean, axis, tmin, tmax);
+	float e[2][4];
+	for (uint32_t c = 0 ; c < 4; c++) {
+		e[0][c] = mean[c] + axis[c] * tmin;
+		e[1][c] = mean[c] + axis[c] * tmax;
+	}
+
+	uint32_t best_err = UINT32_MAX;
+	uint8_t best_q[2][4] = {};
+	uint8_t best_p[2] = {};
+	uint8_t best_indices[16] = {};
+	for (uint32_t pbits = 0 ; pbits < 4; pbits++) {
+		uint8_t q[2][4];
+		uint8_t p[2] = { uint8_t(pbits & 1), uint8_t(pbits >> 1) };
+		uint8_t endpoint[2][4];
+		for (uint32_t n = 0 ; n < 2; n++) {
+			for (uint32_t c = 0 ; c < 4; c++) {
+				int32_t v = (int32_t(bc_clamp_u8(e[n][c])) - p[n] + 1) >> 1;
+				q[n][c] = std::min(std::max(v, 0), 127);
+				endpoint[n][c] = (q[n][c] << 1) | p[n];
+			}
+		}
+		uint8_t palette[16][4];
+		uint8_t indices[16];
+		bc7_palette(endpoint[0], endpoint[1], palette);
+		uint32_t err = bc_select_indices(texels, palette, 16, true, indices);
+		if (err < best_err) {
+			best_err = err;
+			memcpy(best_q, q, sizeof(q));
+			memcpy(best_p, p, sizeof(p));
+			memcpy(best_indices, indices, sizeof(indices));
+		}
+	}
+
+	//the msb of the first index is implicit zero.
+	if (best_indices[0] & 8) {
+		for (uint32_t c = 0 ; c < 4; c++)
+			std::swap(best_q[0][c], best_q[1][c]);
+		std::swap(best_p[0], best_p[1]);
+		for (auto & index : best_indices)
+			index = 15 - index;
+	}
+
+	uint32_t pos = 0;
+	memset(dst, 0, 16);
+	bc_put_bits(dst, pos, 1 << 6, 7);
+	for (uint32_t c = 0 ; c < 4; c++) {
+		bc_put_bits(dst, pos, best_q[0][c], 7);
+		bc_put_bits(dst, pos, best_q[1][c], 7);
+	}
+	bc_put_bits(dst, pos, best_p[0], 1);
+	bc_put_bits(dst, pos, best_p[1], 1);
+	for (uint32_t i = 0 ; i < 16; i++)
+		bc_put_bits(dst, pos, best_indices[i], i == 0 ? 3 : 4);
+}
+
+inline void
+bc1_decode_color(const uint8_t *src, uint8_t texels[16][4])
+{
+	uint16_t c0 = src[0] | (src[1] << 8);
+	uint16_t c1 = src[2] | (src[3] << 8);
+	uint32_t bits = 0;
+	memcpy(&bits, src + 4, sizeof(bits));
+	uint8_t palette[4][4];
+	bc1_palette(c0, c1, palette);
+	for (uint32_t i = 0 ; i < 16; i++)
+		memcpy(texels[i], palette[(bits >> (i * 2)) & 3], 4);
+}
+
+inline void
+bc4_decode_alpha(const uint8_t *src, uint8_t texels[16][4])
+{
+	uint8_t palette[8];
+	bc4_palette(src[0], src[1], palette);
+	uint64_t bits = 0;
+	for (uint32_t i = 0 ; i < 6; i++)
+		bits |= uint64_t(src[2 + i]) << (i * 8);
+	for (uint32_t i = 0 ; i < 16; i++)
+		texels[i][3] = palette[(bits >> (i * 3)) & 7];
+}
+
+//mode 6 only, other modes decode to zero and return false.
+inline bool
+bc7_decode_block(const uint8_t *src, uint8_t texels[16][4])
+{
+	uint32_t pos = 0;
+	if (bc_get_bits(src, pos, 7) != (1 << 6)) {
+		memset(texels, 0, 16 * 4);
+		return (false);
+	}
+	uint8_t endpoint[2][4];
+	for (uint32_t c = 0 ; c < 4; c++) {
+		endpoint[0][c] = bc_get_bits(src, pos, 7) << 1;
+		endpoint[1][c] = bc_get_bits(src, pos, 7) << 1;
+	}
+	uint32_t p0 = bc_get_bits(src, pos, 1);
+	uint32_t p1 = bc_get_bits(src, pos, 1);
+	for (uint32_t c = 0 ; c < 4; c++) {
+		endpoint[0][c] |= p0;
+		endpoint[1][c] |= p1;
+	}
+	uint8_t palette[16][4];
+	bc7_palette(endpoint[0], endpoint[1], palette);
+	for (uint32_t i = 0 ; i < 16; i++)
+		memcpy(texels[i], palette[bc_get_bits(src, pos, i == 0 ? 3 : 4)], 4);
+	return (true);
+}
+
+inline void
+bc_encode_block(uint32_t format, const uint8_t texels[16][4], uint8_t *dst)
+{
+	if (format == BC_FORMAT_BC1) {
+		bc1_encode_color(texels, dst);
+	} else if (format == BC_FORMAT_BC3) {
+		bc4_encode_alpha(texels, dst);
+		bc1_encode_color(texels, dst + 8);
+	} else {
+		bc7_encode_block(texels, dst);
+	}
+}
+
+inline void
+bc_decode_block(uint32_t format, const uint8_t *src, uint8_t texels[16][4])
+{
+	if (format == BC_FORMAT_BC1) {
+		bc1_decode_color(src, texels);
+	} else if (format == BC_FORMAT_BC3) {
+		bc1_decode_color(src + 8, texels);
+		bc4_decode_alpha(src, texels);
+	} else {
+		bc7_decode_block(src, texels);
+	}
+}
+
+//fn(index) for index in [0, count), thread_max 0 uses every core.
+inline void
+bc_parallel_for(uint32_t count, uint32_t thread_max, const std::function<void(uint32_t)> & fn)
+{
+	if (thread_max == 0)
+		thread_max = std::thread::hardware_concurrency();
+	thread_max = std::max(1u, std::min(thread_max, count));
+	std::atomic<uint32_t> next = 0;
+	auto worker = [&]() {
+		for (uint32_t index = next++; index < count; index = next++)
+			fn(index);
+	};
+	std::vector<std::thread> threads;
+	for (uint32_t i = 1 ; i < thread_max; i++)
+		threads.push_back(std::thread(worker));
+	worker();
+	for (auto & th : threads)
+		th.join();
+}
+
+//src : width * height RGBA8, dst : bc_image_bytes(format, width, height). the edges repeat.
+inline void
+bc_encode_image(uint32_t format, uint32_t width, uint32_t height, const uint32_t *src, uint8_t *dst, uint32_t thread_max = 0)
+{
+	uint32_t bw = (width + 3) / 4;
+	uint32_t bh = (height + 3) / 4;
+	uint32_t block_bytes = bc_block_bytes(format);
+	bc_parallel_for(bh, thread_max, [&](uint32_t by) {
+		for (uint32_t bx = 0 ; bx < bw; bx++) {
+			alignas(16) uint8_t texels[16][4];
+			for (uint32_t i = 0 ; i < 16; i++) {
+				uint32_t x = std::min(bx * 4 + (i & 3), width - 1);
+				uint32_t y = std::min(by * 4 + (i >> 2), height - 1);
+				memcpy(texels[i], &src[y * width + x], 4);
+			}
+			bc_encode_block(format, texels, dst + (by * bw + bx) * block_bytes);
+		}
+	});
+}
+
+inline void
+bc_decode_image(uint32_t format, uint32_t width, uint32_t height, const uint8_t *src, uint32_t *dst, uint32_t thread_max = 0)
+{
+	uint32_t bw = (width + 3) / 4;
+	uint32_t bh = (height + 3) / 4;
+	uint32_t block_bytes = bc_block_bytes(format);
+	bc_parallel_for(bh, thread_max, [&](uint32_t by) {
+		for (uint32_t bx = 0 ; bx < bw; bx++) {
+			uint8_t texels[16][4];
+			bc_decode_block(format, src + (by * bw + bx) * block_bytes, texels);
+			for (uint32_t i = 0 ; i < 16; i++) {
+				uint32_t x = bx * 4 + (i & 3);
+				uint32_t y = by * 4 + (i >> 2);
+				if (x < width && y < height)
+					memcpy(&dst[y * width + x], texels[i], 4);
+			}
+		}
+	});
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2020 gyabo <gyaboyan@gmail.com>
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// Renders one scene with cpucontext_t twice, once with the AVX2 span path
+// and once with ScalarSpans, and checks that the layers and the output are
+// the same bytes. Build it with the flags of the renderer (/arch:AVX2,
+// -mavx2 -mfma, -march=native ...). The printed checksum of the output
+// must also be the same for every build.
+// usage : cpu_check [objects per layer]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <random>
+#include "cpucontext.h"
+
+static void
+render_scene(cpucontext_t & ctx, uint32_t object_count)
+{
+	std::minstd_rand rng(1);
+	auto frand = [&](float lo, float hi) {
+		return lo + (hi - lo) * float(rng() & 0xFFFFFF) / float(0xFFFFFF);
+	};
+
+	//a checker and a noise texture.
+	std::vector<uint32_t> texels(64 * 64);
+	for (uint32_t y = 0 ; y < 64; y++)
+		for (uint32_t x = 0 ; x < 64; x++)
+			texels[y * 64 + x] = ((x ^ y) & 8) ? 0xFFFFFFFF : 0xFF204080;
+	ctx.upload_user_image(0, 64, 64, texels.data());
+	for (auto & t : texels)
+		t = uint32_t(rng());
+	ctx.upload_user_image(1, 64, 64, texels.data());
+
+	uint32_t last = ctx.info.LayerMax - 1;
+	for (uint32_t layer = 0 ; layer < last; layer++) {
+		auto p = ctx.get_object_format_address(layer);
+		for (uint32_t i = 0 ; i < object_count; i++, p++) {
+			*p = {};
+			p->metadata[0] = 1;
+			p->metadata[1] = rng() % 3;
+			p->pos[0] = frand(-1.2f, 1.2f);
+			p->pos[1] = frand(-1.2f, 1.2f);
+			p->scale[0] = frand(0.01f, 0.2f);
+			p->scale[1] = frand(0.01f, 0.2f);
+			p->rotate[0] = frand(-8.0f, 8.0f);
+			for (auto & c : p->color)
+				c = frand(0.0f, 1.0f);
+			p->uvinfo[0] = float(rng() % 4);
+			p->uvinfo[1] = float(rng() % 4);
+			p->uvinfo[2] = float(1 + rng() % 4);
+			p->uvinfo[3] = float(1 + rng() % 4);
+		}
+		ctx.draw_triangles(layer, object_count * 6);
+	}
+
+	//full screen present quad.
+	auto p = ctx.get_object_format_address(last);
+	*p = {};
+	p->metadata[0] = 1;
+	p->scale[0] = 1;
+	p->scale[1] = 1;
+	p->uvinfo[2] = 1;
+	p->uvinfo[3] = 1;
+	ctx.draw_triangles(last, 6);
+	ctx.submit();
+}
+
+static uint32_t
+compare_bytes(const char *name, const uint32_t *a, const uint32_t *b, uint32_t count)
+{
+	uint32_t ret = 0;
+	const uint8_t *pa = (const uint8_t *)a;
+	const uint8_t *pb = (const uint8_t *)b;
+	for (uint32_t i = 0 ; i < count * 4; i++)
+		if (pa[i] != pb[i])
+			ret++;
+	if (ret)
+		printf("cpu_check : %s, %d bytes differ\n", name, ret);
+	return (ret);
+}
+
+//fnv-1a
+static uint32_t
+checksum(const uint32_t *p, uint32_t count)
+{
+	uint32_t ret = 2166136261u;
+	const uint8_t *b = (const uint8_t *)p;
+	for (uint32_t i = 0 ; i < count * 4; i++)
+		ret = (ret ^ b[i]) * 16777619u;
+	return (ret);
+}
+
+int
+main(int argc, char *argv[])
+{
+	uint32_t object_count = argc > 1 ? atoi(argv[1]) : 2000;
+	cpucontext_t::create_info info = {};
+	info.ScreenW = 1024;
+	info.ScreenH = 1024;
+	info.Width = 480;
+	info.Height = 640;
+	info.LayerMax = 4;
+	info.UserImageMax = 4;
+	info.ObjectMax = std::max(object_count, 1u);
+	object_count = info.ObjectMax;
+
+	cpucontext_t ctx_simd;
+	cpucontext_t ctx_scalar;
+	ctx_simd.init(info);
+	info.ScalarSpans = true;
+	ctx_scalar.init(info);
+	render_scene(ctx_simd, object_count);
+	render_scene(ctx_scalar, object_count);
+
+	uint32_t mismatch = 0;
+	for (uint32_t layer = 0 ; layer < info.LayerMax; layer++) {
+		char name[32];
+		snprintf(name, sizeof(name), "layer %d", layer);
+		mismatch += compare_bytes(name, ctx_simd.get_layer_address(layer), ctx_scalar.get_layer_address(layer), info.Width * info.Height);
+	}
+	mismatch += compare_bytes("output", ctx_simd.get_output_address(), ctx_scalar.get_output_address(), info.ScreenW * info.ScreenH);
+#ifdef __AVX2__
+	printf("cpu_check : %d objects per layer, %d bytes differ", object_count, mismatch);
+#else
+	printf("cpu_check : built without AVX2, both runs use the scalar path, %d bytes differ", mismatch);
+#endif //__AVX2__
+	printf(", output checksum %08X\n", checksum(ctx_scalar.get_output_address(), info.ScreenW * info.ScreenH));
+	return (mismatch ? 1 : 0);
+}
@@ -0,0 +1,724 @@
+/*
+ * Copyright (c) 2020 gyabo <gyaboyan@gmail.com>
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+#pragma once
+
+//
+// Pure CPU backend with the same frame API as vkcontext_t.
+// Every layer expands object_format to quads (update_buffer.glsl),
+// bins them into tiles, rasterizes draw_rect.glsl / present.glsl per tile
+// on a thread pool and finally scales the last layer like cmd_blit_image.
+// Build with AVX2 enabled (/arch:AVX2, -mavx2) to get the 8-wide span path.
+// Every float product goes through cpu_mul/cpu_mul8, which the compiler
+// cannot fuse into a following add, so the scalar and the AVX2 spans give
+// the same pixels and so does every build, with or without FMA
+// (cpu_check.cpp compares them).
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif //__AVX2__
+
+#ifdef _MSC_VER
+#pragma fp_contract(off)
+#endif //_MSC_VER
+
+//a * b, rounded before it is used.
+static inline float
+cpu_mul(float a, float b)
+{
+	float ret = a * b;
+#if defined(__GNUC__) || defined(__clang__)
+	__asm__("" : "+x"(ret));
+#endif
+	return (ret);
+}
+
+//a * b + c with two roundings.
+static inline float
+cpu_madd(float a, float b, float c)
+{
+	return (cpu_mul(a, b) + c);
+}
+
+#ifdef __AVX2__
+static inline __m256
+cpu_mul8(__m256 a, __m256 b)
+{
+	__m256 ret = _mm256_mul_ps(a, b);
+#if defined(__GNUC__) || defined(__clang__)
+	__asm__("" : "+x"(ret));
+#endif
+	return (ret);
+}
+
+static inline __m256
+cpu_madd8(__m256 a, __m256 b, __m256 c)
+{
+	return (_mm256_add_ps(cpu_mul8(a, b), c));
+}
+#endif //__AVX2__
+
+struct cpu_thread_pool_t {
+	std::vector<std::thread> threads;
+	std::mutex mtx;
+	std::condition_variable cv_start;
+	std::condition_variable cv_done;
+	std::function<void(uint32_t)> job;
+	std::atomic<uint32_t> job_next = 0;
+	uint32_t job_count = 0;
+	uint32_t busy_count = 0;
+	uint64_t generation = 0;
+	bool is_exit = false;
+
+	void init(uint32_t thread_max)
+	{
+		//the calling thread works too.
+		for (uint32_t i = 1 ; i < thread_max; i++)
+			threads.push_back(std::thread([this]() {
+			worker();
+		}));
+	}
+
+	~cpu_thread_pool_t()
+	{
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			is_exit = true;
+		}
+		cv_start.notify_all();
+		for (auto & th : threads)
+			th.join();
+	}
+
+	void run_jobs()
+	{
+		for (;;) {
+			uint32_t index = job_next.fetch_add(1);
+			if (index >= job_count)
+				break;
+			job(index);
+		}
+	}
+
+	void worker()
+	{
+		uint64_t seen = 0;
+		for (;;) {
+			std::unique_lock<std::mutex> lk(mtx);
+			cv_start.wait(lk, [&]() {
+				return is_exit || generation != seen;
+			});
+			if (is_exit)
+				return;
+			seen = generation;
+			lk.unlock();
+			run_jobs();
+			lk.lock();
+			if (--busy_count == 0)
+				cv_done.notify_all();
+		}
+	}
+
+	void parallel_for(uint32_t count, std::function<void(uint32_t)> fn)
+	{
+		if (count == 0)
+			return;
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			job = fn;
+			job_count = count;
+			job_next = 0;
+			busy_count = threads.size();
+			generation++;
+		}
+		cv_start.notify_all();
+		run_jobs();
+		std::unique_lock<std::mutex> lk(mtx);
+		cv_done.wait(lk, [&]() {
+			return busy_count == 0;
+		});
+	}
+};
+
+struct cpucontext_t {
+	//same layout as vkcontext_t::object_format.
+	struct object_format {
+		float pos[4];
+		float scale[4];
+		float rotate[4];
+		float color[4];
+		float uvinfo[4];
+		uint32_t metadata[4];
+	};
+
+	enum {
+		LAYER_TYPE_DRAW_RECT = 0,
+		LAYER_TYPE_PRESENT,
+	};
+
+	enum {
+		TileSize = 64,
+		ChunkSize = 256,
+	};
+
+	struct create_info {
+		uint32_t ScreenW;
+		uint32_t ScreenH;
+		uint32_t Width;
+		uint32_t Height;
+		uint32_t ObjectMax;
+		uint32_t LayerMax;
+		uint32_t UserImageMax;
+		uint32_t ThreadMax;
+		//shade with the scalar span path even when AVX2 is available.
+		bool ScalarSpans;
+		//LAYER_TYPE_*, one per layer. empty : draw_rect and present as the last layer.
+		std::vector<uint32_t> layer_types;
+	};
+	create_info info = {};
+
+	//parallelogram in pixel space.
+	//s, t are the quad local coordinates : s = sx * X + sy * Y + sc.
+	struct quad_t {
+		float sx, sy, sc;
+		float tx, ty, tc;
+		float u0, du;
+		float v0, dv;
+		float color[4];
+		uint32_t matid;
+		int32_t bbox[4];
+	};
+
+	struct image_t {
+		uint32_t width = 0;
+		uint32_t height = 0;
+		std::vector<uint32_t> texels;
+	};
+
+	struct layer_t {
+		std::vector<object_format> objects;
+		std::vector<quad_t> quads;
+		std::vector<uint8_t> quad_valid;
+		image_t image;
+		uint32_t vertex_count = 0;
+	};
+
+	cpu_thread_pool_t pool;
+	std::vector<layer_t> layers;
+	std::vector<image_t> user_images;
+	std::vector<std::vector<std::vector<uint32_t> > > bins;
+	image_t output;
+	uint32_t tile_w = 0;
+	uint32_t tile_h = 0;
+	uint64_t frame_count = 0;
+
+	void init(create_info & userinfo)
+	{
+		info = userinfo;
+		if (info.ThreadMax == 0)
+			info.ThreadMax = std::max(1u, std::thread::hardware_concurrency());
+		if (info.layer_types.size() != info.LayerMax) {
+			info.layer_types.assign(info.LayerMax, LAYER_TYPE_DRAW_RECT);
+			info.layer_types[info.LayerMax - 1] = LAYER_TYPE_PRESENT;
+		}
+		pool.init(info.ThreadMax);
+
+		tile_w = (info.Width + TileSize - 1) / TileSize;
+		tile_h = (info.Height + TileSize - 1) / TileSize;
+		layers.resize(info.LayerMax);
+		for (auto & layer : layers) {
+			layer.objects.resize(info.ObjectMax);
+			layer.quads.resize(info.ObjectMax);
+			layer.quad_valid.resize(info.ObjectMax);
+			layer.image.width = info.Width;
+			layer.image.height = info.Height;
+			layer.image.texels.resize(info.Width * info.Height);
+		}
+		user_images.resize(info.UserImageMax);
+		bins.resize((info.ObjectMax + ChunkSize - 1) / ChunkSize);
+		for (auto & chunk : bins)
+			chunk.resize(tile_w * tile_h);
+		output.width = info.ScreenW;
+		output.height = info.ScreenH;
+		output.texels.resize(info.ScreenW * info.ScreenH);
+	}
+
+	void upload_user_image(uint32_t slot, uint32_t width, uint32_t height, void *src)
+	{
+		if (slot >= user_images.size())
+			return;
+		auto & uimg = user_images[slot];
+		uimg.width = width;
+		uimg.height = height;
+		uimg.texels.resize(width * height);
+		memcpy(uimg.texels.data(), src, width * height * sizeof(uint32_t));
+	}
+
+	void draw_triangles(uint32_t layer_index, uint32_t vertexCount)
+	{
+		layers[layer_index].vertex_count = vertexCount;
+	}
+
+	object_format *get_object_format_address(uint32_t layer_index)
+	{
+		return layers[layer_index].objects.data();
+	}
+
+	//RGBA8, ScreenW x ScreenH.
+	const uint32_t *get_output_address()
+	{
+		return output.texels.data();
+	}
+
+	//RGBA8, Width x Height.
+	const uint32_t *get_layer_address(uint32_t layer_index)
+	{
+		return layers[layer_index].image.texels.data();
+	}
+
+	int submit()
+	{
+		for (uint32_t layer_num = 0 ; layer_num < layers.size(); layer_num++)
+			render_layer(layer_num);
+		blit_output(layers.back().image);
+		frame_count++;
+
+		return (0);
+	}
+
+	//update_buffer.glsl
+	static bool expand_object(const object_format & obj, float w, float h, quad_t & q)
+	{
+		if (obj.metadata[0] == 0)
+			return false;
+
+		float c = cosf(obj.rotate[0]);
+		float s = sinf(obj.rotate[0]);
+		float corner[3][2] = {
+			{-1, -1}, //basepos[0]
+			{-1,  1}, //basepos[1]
+			{ 1, -1}, //basepos[2]
+		};
+		float p[3][2];
+		for (int i = 0 ; i < 3; i++) {
+			float x = corner[i][0] * obj.scale[0];
+			float y = corner[i][1] * obj.scale[1];
+			float rx = cpu_mul(x, c) - cpu_mul(y, s) + obj.pos[0];
+			float ry = cpu_mul(x, s) + cpu_mul(y, c) + obj.pos[1];
+			p[i][0] = cpu_mul(cpu_madd(rx, 0.5f, 0.5f), w);
+			p[i][1] = cpu_mul(cpu_madd(ry, 0.5f, 0.5f), h);
+		}
+
+		//basepos[3] = basepos[1] + basepos[2] - basepos[0]
+		float eu[2] = { p[2][0] - p[0][0], p[2][1] - p[0][1] };
+		float ev[2] = { p[1][0] - p[0][0], p[1][1] - p[0][1] };
+		float det = cpu_mul(eu[0], ev[1]) - cpu_mul(eu[1], ev[0]);
+		if (fabsf(det) < 1.0e-12f)
+			return false;
+		float inv_det = 1.0f / det;
+		q.sx = cpu_mul(ev[1], inv_det);
+		q.sy = cpu_mul(-ev[0], inv_det);
+		q.sc = -(cpu_mul(q.sx, p[0][0]) + cpu_mul(q.sy, p[0][1]));
+		q.tx = cpu_mul(-eu[1], inv_det);
+		q.ty = cpu_mul(eu[0], inv_det);
+		q.tc = -(cpu_mul(q.tx, p[0][0]) + cpu_mul(q.ty, p[0][1]));
+
+		q.du = 1.0f / obj.uvinfo[2];
+		q.dv = 1.0f / obj.uvinfo[3];
+		q.u0 = cpu_mul(q.du, obj.uvinfo[0]);
+		q.v0 = cpu_mul(q.dv, obj.uvinfo[1]);
+		for (int i = 0 ; i < 4; i++)
+			q.color[i] = obj.color[i];
+		q.matid = obj.metadata[1];
+
+		float x0 = std::min({p[0][0], p[1][0], p[2][0], p[1][0] + eu[0]});
+		float x1 = std::max({p[0][0], p[1][0], p[2][0], p[1][0] + eu[0]});
+		float y0 = std::min({p[0][1], p[1][1], p[2][1], p[1][1] + eu[1]});
+		float y1 = std::max({p[0][1], p[1][1], p[2][1], p[1][1] + eu[1]});
+		q.bbox[0] = std::max(0, int32_t(floorf(x0)));
+		q.bbox[1] = std::max(0, int32_t(floorf(y0)));
+		q.bbox[2] = std::min(int32_t(w), int32_t(ceilf(x1)) + 1);
+		q.bbox[3] = std::min(int32_t(h), int32_t(ceilf(y1)) + 1);
+
+		return q.bbox[0] < q.bbox[2] && q.bbox[1] < q.bbox[3];
+	}
+
+	//narrow [lo, hi) to the X where a * X + b is in [0, 1).
+	static bool clip_span(float a, float b, float & lo, float & hi)
+	{
+		if (a == 0.0f)
+			return b >= 0.0f && b < 1.0f;
+		float x0 = -b / a;
+		float x1 = (1.0f - b) / a;
+		if (a < 0.0f)
+			std::swap(x0, x1);
+		lo = std::max(lo, x0);
+		hi = std::min(hi, x1);
+		return lo < hi;
+	}
+
+	static inline float unorm8(uint32_t v, uint32_t shift)
+	{
+		return (cpu_mul(float((v >> shift) & 0xFF), 1.0f / 255.0f));
+	}
+
+	static inline uint32_t pack_unorm8(float v, uint32_t shift)
+	{
+		v = std::min(std::max(v, 0.0f), 1.0f);
+		return uint32_t(cpu_madd(v, 255.0f, 0.5f)) << shift;
+	}
+
+	static inline float wrap_coord(float x, float size, float inv_size)
+	{
+		x = x - cpu_mul(floorf(cpu_mul(x, inv_size)), size);
+		if (x >= size)
+			x -= size;
+		if (x < 0.0f)
+			x += size;
+		return x;
+	}
+
+	//linear filter, repeat address mode.
+	static void sample_image(const image_t & img, float u, float v, float rgba[4])
+	{
+		float w = float(img.width);
+		float h = float(img.height);
+		float xf = cpu_madd(u, w, -0.5f);
+		float yf = cpu_madd(v, h, -0.5f);
+		float x0 = floorf(xf);
+		float y0 = floorf(yf);
+		float fx = xf - x0;
+		float fy = yf - y0;
+		x0 = wrap_coord(x0, w, 1.0f / w);
+		y0 = wrap_coord(y0, h, 1.0f / h);
+		float x1 = x0 + 1.0f;
+		float y1 = y0 + 1.0f;
+		if (x1 >= w)
+			x1 -= w;
+		if (y1 >= h)
+			y1 -= h;
+		uint32_t t00 = img.texels[uint32_t(y0) * img.width + uint32_t(x0)];
+		uint32_t t10 = img.texels[uint32_t(y0) * img.width + uint32_t(x1)];
+		uint32_t t01 = img.texels[uint32_t(y1) * img.width + uint32_t(x0)];
+		uint32_t t11 = img.texels[uint32_t(y1) * img.width + uint32_t(x1)];
+		for (int i = 0 ; i < 4; i++) {
+			float c00 = unorm8(t00, i * 8);
+			float c10 = unorm8(t10, i * 8);
+			float c01 = unorm8(t01, i * 8);
+			float c11 = unorm8(t11, i * 8);
+			float c0 = cpu_madd(c10 - c00, fx, c00);
+			float c1 = cpu_madd(c11 - c01, fx, c01);
+			rgba[i] = cpu_madd(c1 - c0, fy, c0);
+		}
+	}
+
+	void shade_span_scalar(const quad_t & q, uint32_t layer_num, uint32_t *dst, int32_t xa, int32_t xb, float s_row, float t_row)
+	{
+		const image_t *tex = nullptr;
+		bool is_present = info.layer_types[layer_num] == LAYER_TYPE_PRESENT;
+		if (!is_present && q.matid < user_images.size() && !user_images[q.matid].texels.empty())
+			tex = &user_images[q.matid];
+
+		for (int32_t x = xa; x < xb; x++) {
+			float fx = float(x) + 0.5f;
+			float s = cpu_madd(q.sx, fx, s_row);
+			float t = cpu_madd(q.tx, fx, t_row);
+			if (!(s >= 0.0f && s < 1.0f && t >= 0.0f && t < 1.0f))
+				continue;
+			float u = cpu_madd(s, q.du, q.u0);
+			float v = cpu_madd(t, q.dv, q.v0);
+			float src[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+			if (is_present) {
+				//present.glsl : sum of the layers below, alpha = 1.
+				src[0] = src[1] = src[2] = 0.0f;
+				for (uint32_t i = 0 ; i < layer_num; i++) {
+					float rgba[4];
+					sample_image(layers[i].image, u, v, rgba);
+					src[0] += rgba[0];
+					src[1] += rgba[1];
+					src[2] += rgba[2];
+				}
+			} else {
+				//draw_rect.glsl : texture * color, alpha = color.a.
+				if (tex)
+					sample_image(*tex, u, v, src);
+				src[0] = cpu_mul(src[0], q.color[0]);
+				src[1] = cpu_mul(src[1], q.color[1]);
+				src[2] = cpu_mul(src[2], q.color[2]);
+				src[3] = q.color[3];
+			}
+
+			//SRC_ALPHA, ONE_MINUS_SRC_ALPHA / ONE, ZERO
+			uint32_t d = dst[x];
+			float a = src[3];
+			float r = cpu_madd(src[0], a, cpu_mul(unorm8(d, 0), 1.0f - a));
+			float g = cpu_madd(src[1], a, cpu_mul(unorm8(d, 8), 1.0f - a));
+			float b = cpu_madd(src[2], a, cpu_mul(unorm8(d, 16), 1.0f - a));
+			dst[x] = pack_unorm8(r, 0) | pack_unorm8(g, 8) | pack_unorm8(b, 16) | pack_unorm8(a, 24);
+		}
+	}
+
+#ifdef __AVX2__
+	static inline __m256 unorm8x8(__m256i v, int shift)
+	{
+		__m256i c = _mm256_and_si256(_mm256_srli_epi32(v, shift), _mm256_set1_epi32(0xFF));
+		return (cpu_mul8(_mm256_cvtepi32_ps(c), _mm256_set1_ps(1.0f / 255.0f)));
+	}
+
+	static inline __m256i pack_unorm8x8(__m256 v, int shift)
+	{
+		v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+		v = cpu_madd8(v, _mm256_set1_ps(255.0f), _mm256_set1_ps(0.5f));
+		return _mm256_slli_epi32(_mm256_cvttps_epi32(v), shift);
+	}
+
+	static inline __m256 wrap_coord8(__m256 x, __m256 size, __m256 inv_size)
+	{
+		x = _mm256_sub_ps(x, cpu_mul8(_mm256_floor_ps(cpu_mul8(x, inv_size)), size));
+		x = _mm256_sub_ps(x, _mm256_and_ps(_mm256_cmp_ps(x, size, _CMP_GE_OQ), size));
+		x = _mm256_add_ps(x, _mm256_and_ps(_mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ), size));
+		return x;
+	}
+
+	//8 lanes of sample_image, masked lanes are not fetched.
+	static void sample_image8(const image_t & img, __m256 u, __m256 v, __m256 mask, __m256 rgba[4])
+	{
+		__m256 w = _mm256_set1_ps(float(img.width));
+		__m256 h = _mm256_set1_ps(float(img.height));
+		__m256 half = _mm256_set1_ps(0.5f);
+		__m256 one = _mm256_set1_ps(1.0f);
+		__m256 xf = _mm256_sub_ps(cpu_mul8(u, w), half);
+		__m256 yf = _mm256_sub_ps(cpu_mul8(v, h), half);
+		__m256 x0 = _mm256_floor_ps(xf);
+		__m256 y0 = _mm256_floor_ps(yf);
+		__m256 fx = _mm256_sub_ps(xf, x0);
+		__m256 fy = _mm256_sub_ps(yf, y0);
+		x0 = wrap_coord8(x0, w, _mm256_set1_ps(1.0f / float(img.width)));
+		y0 = wrap_coord8(y0, h, _mm256_set1_ps(1.0f / float(img.height)));
+		__m256 x1 = _mm256_add_ps(x0, one);
+		__m256 y1 = _mm256_add_ps(y0, one);
+		x1 = _mm256_sub_ps(x1, _mm256_and_ps(_mm256_cmp_ps(x1, w, _CMP_GE_OQ), w));
+		y1 = _mm256_sub_ps(y1, _mm256_and_ps(_mm256_cmp_ps(y1, h, _CMP_GE_OQ), h));
+
+		__m256i iw = _mm256_set1_epi32(img.width);
+		__m256i ix0 = _mm256_cvttps_epi32(x0);
+		__m256i ix1 = _mm256_cvttps_epi32(x1);
+		__m256i row0 = _mm256_mullo_epi32(_mm256_cvttps_epi32(y0), iw);
+		__m256i row1 = _mm256_mullo_epi32(_mm256_cvttps_epi32(y1), iw);
+		__m256i imask = _mm256_castps_si256(mask);
+		__m256i zero = _mm256_setzero_si256();
+		const int *base = (const int *)img.texels.data();
+		__m256i t00 = _mm256_mask_i32gather_epi32(zero, base, _mm256_add_epi32(row0, ix0), imask, 4);
+		__m256i t10 = _mm256_mask_i32gather_epi32(zero, base, _mm256_add_epi32(row0, ix1), imask, 4);
+		__m256i t01 = _mm256_mask_i32gather_epi32(zero, base, _mm256_add_epi32(row1, ix0), imask, 4);
+		__m256i t11 = _mm256_mask_i32gather_epi32(zero, base, _mm256_add_epi32(row1, ix1), imask, 4);
+		for (int i = 0 ; i < 4; i++) {
+			__m256 c00 = unorm8x8(t00, i * 8);
+			__m256 c10 = unorm8x8(t10, i * 8);
+			__m256 c01 = unorm8x8(t01, i * 8);
+			__m256 c11 = unorm8x8(t11, i * 8);
+			__m256 c0 = cpu_madd8(_mm256_sub_ps(c10, c00), fx, c00);
+			__m256 c1 = cpu_madd8(_mm256_sub_ps(c11, c01), fx, c01);
+			rgba[i] = cpu_madd8(_mm256_sub_ps(c1, c0), fy, c0);
+		}
+	}
+
+	void shade_span_avx2(const quad_t & q, uint32_t layer_num, uint32_t *dst, int32_t xa, int32_t xb, float s_row, float t_row)
+	{
+		const image_t *tex = nullptr;
+		bool is_present = info.layer_types[layer_num] == LAYER_TYPE_PRESENT;
+		if (!is_present && q.matid < user_images.size() && !user_images[q.matid].texels.empty())
+			tex = &user_images[q.matid];
+
+		__m256 zero = _mm256_setzero_ps();
+		__m256 one = _mm256_set1_ps(1.0f);
+		__m256 lane = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+		__m256i lane_index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		for (int32_t x = xa; x < xb; x += 8) {
+			__m256 fx = _mm256_add_ps(_mm256_set1_ps(float(x)), lane);
+			__m256 s = cpu_madd8(_mm256_set1_ps(q.sx), fx, _mm256_set1_ps(s_row));
+			__m256 t = cpu_madd8(_mm256_set1_ps(q.tx), fx, _mm256_set1_ps(t_row));
+			__m256 mask = _mm256_and_ps(_mm256_cmp_ps(s, zero, _CMP_GE_OQ), _mm256_cmp_ps(s, one, _CMP_LT_OQ));
+			mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+			mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, one, _CMP_LT_OQ));
+			__m256i tail = _mm256_cmpgt_epi32(_mm256_set1_epi32(xb - x), lane_index);
+			mask = _mm256_and_ps(mask, _mm256_castsi256_ps(tail));
+			if (_mm256_movemask_ps(mask) == 0)
+				continue;
+
+			__m256 u = cpu_madd8(s, _mm256_set1_ps(q.du), _mm256_set1_ps(q.u0));
+			__m256 v = cpu_madd8(t, _mm256_set1_ps(q.dv), _mm256_set1_ps(q.v0));
+			__m256 src[4] = {one, one, one, one};
+			if (is_present) {
+				src[0] = src[1] = src[2] = zero;
+				for (uint32_t i = 0 ; i < layer_num; i++) {
+					__m256 rgba[4];
+					sample_image8(layers[i].image, u, v, mask, rgba);
+					src[0] = _mm256_add_ps(src[0], rgba[0]);
+					src[1] = _mm256_add_ps(src[1], rgba[1]);
+					src[2] = _mm256_add_ps(src[2], rgba[2]);
+				}
+			} else {
+				if (tex)
+					sample_image8(*tex, u, v, mask, src);
+				src[0] = cpu_mul8(src[0], _mm256_set1_ps(q.color[0]));
+				src[1] = cpu_mul8(src[1], _mm256_set1_ps(q.color[1]));
+				src[2] = cpu_mul8(src[2], _mm256_set1_ps(q.color[2]));
+				src[3] = _mm256_set1_ps(q.color[3]);
+			}
+
+			__m256i imask = _mm256_castps_si256(mask);
+			__m256i d = _mm256_maskload_epi32((const int *)(dst + x), imask);
+			__m256 a = src[3];
+			__m256 inv_a = _mm256_sub_ps(one, a);
+			__m256 r = cpu_madd8(src[0], a, cpu_mul8(unorm8x8(d, 0), inv_a));
+			__m256 g = cpu_madd8(src[1], a, cpu_mul8(unorm8x8(d, 8), inv_a));
+			__m256 b = cpu_madd8(src[2], a, cpu_mul8(unorm8x8(d, 16), inv_a));
+			__m256i result = _mm256_or_si256(
+					_mm256_or_si256(pack_unorm8x8(r, 0), pack_unorm8x8(g, 8)),
+					_mm256_or_si256(pack_unorm8x8(b, 16), pack_unorm8x8(a, 24)));
+			_mm256_maskstore_epi32((int *)(dst + x), imask, result);
+		}
+	}
+#endif //__AVX2__
+
+	void raster_quad(const quad_t & q, uint32_t layer_num, const int32_t rect[4])
+	{
+		auto & img = layers[layer_num].image;
+		int32_t y0 = std::max(rect[1], q.bbox[1]);
+		int32_t y1 = std::min(rect[3], q.bbox[3]);
+		for (int32_t y = y0; y < y1; y++) {
+			float fy = float(y) + 0.5f;
+			float s_row = cpu_madd(q.sy, fy, q.sc);
+			float t_row = cpu_madd(q.ty, fy, q.tc);
+
+			//conservative span, the shader tests every pixel exactly.
+			float lo = -1.0e30f;
+			float hi = 1.0e30f;
+			if (!clip_span(q.sx, s_row, lo, hi) || !clip_span(q.tx, t_row, lo, hi))
+				continue;
+			int32_t xa = std::max({rect[0], q.bbox[0], int32_t(std::max(lo, -1.0e9f)) - 1});
+			int32_t xb = std::min({rect[2], q.bbox[2], int32_t(std::min(hi, 1.0e9f)) + 1});
+			if (xa >= xb)
+				continue;
+			uint32_t *dst = img.texels.data() + y * img.width;
+#ifdef __AVX2__
+			if (!info.ScalarSpans) {
+				shade_span_avx2(q, layer_num, dst, xa, xb, s_row, t_row);
+				continue;
+			}
+#endif //__AVX2__
+			shade_span_scalar(q, layer_num, dst, xa, xb, s_row, t_row);
+		}
+	}
+
+	void render_layer(uint32_t layer_num)
+	{
+		auto & layer = layers[layer_num];
+		uint32_t object_count = std::min(layer.vertex_count / 6, info.ObjectMax);
+		uint32_t chunk_count = (object_count + ChunkSize - 1) / ChunkSize;
+		float w = float(info.Width);
+		float h = float(info.Height);
+
+		//expand and bin : one job per chunk keeps every bin in object order.
+		pool.parallel_for(chunk_count, [&](uint32_t chunk) {
+			auto & chunk_bins = bins[chunk];
+			for (auto & bin : chunk_bins)
+				bin.clear();
+			uint32_t first = chunk * ChunkSize;
+			uint32_t last = std::min(first + ChunkSize, object_count);
+			for (uint32_t i = first; i < last; i++) {
+				auto & q = layer.quads[i];
+				if (!expand_object(layer.objects[i], w, h, q))
+					continue;
+				int32_t tx0 = q.bbox[0] / TileSize;
+				int32_t ty0 = q.bbox[1] / TileSize;
+				int32_t tx1 = (q.bbox[2] - 1) / TileSize;
+				int32_t ty1 = (q.bbox[3] - 1) / TileSize;
+				for (int32_t ty = ty0; ty <= ty1; ty++)
+					for (int32_t tx = tx0; tx <= tx1; tx++)
+						chunk_bins[ty * tile_w + tx].push_back(i);
+			}
+		});
+
+		//clear and raster : one job per tile, chunks in order.
+		pool.parallel_for(tile_w * tile_h, [&](uint32_t tile) {
+			int32_t rect[4];
+			rect[0] = (tile % tile_w) * TileSize;
+			rect[1] = (tile / tile_w) * TileSize;
+			rect[2] = std::min(uint32_t(rect[0] + TileSize), info.Width);
+			rect[3] = std::min(uint32_t(rect[1] + TileSize), info.Height);
+			for (int32_t y = rect[1]; y < rect[3]; y++) {
+				auto *dst = layer.image.texels.data() + y * info.Width;
+				memset(dst + rect[0], 0, (rect[2] - rect[0]) * sizeof(uint32_t));
+			}
+			for (uint32_t chunk = 0 ; chunk < chunk_count; chunk++)
+				for (auto index : bins[chunk][tile])
+					raster_quad(layer.quads[index], layer_num, rect);
+		});
+	}
+
+	//cmd_blit_image : linear filter, clamp to edge.
+	void blit_output(const image_t & src)
+	{
+		float scale_x = float(src.width) / float(output.width);
+		float scale_y = float(src.height) / float(output.height);
+		pool.parallel_for(output.height, [&](uint32_t y) {
+			float yf = cpu_madd(float(y) + 0.5f, scale_y, -0.5f);
+			yf = std::min(std::max(yf, 0.0f), float(src.height - 1));
+			uint32_t y0 = uint32_t(yf);
+			uint32_t y1 = std::min(y0 + 1, src.height - 1);
+			float fy = yf - float(y0);
+			uint32_t *dst = output.texels.data() + y * output.width;
+			for (uint32_t x = 0 ; x < output.width; x++) {
+				float xf = cpu_madd(float(x) + 0.5f, scale_x, -0.5f);
+				xf = std::min(std::max(xf, 0.0f), float(src.width - 1));
+				uint32_t x0 = uint32_t(xf);
+				uint32_t x1 = std::min(x0 + 1, src.width - 1);
+				float fx = xf - float(x0);
+				uint32_t t00 = src.texels[y0 * src.width + x0];
+				uint32_t t10 = src.texels[y0 * src.width + x1];
+				uint32_t t01 = src.texels[y1 * src.width + x0];
+				uint32_t t11 = src.texels[y1 * src.width + x1];
+				uint32_t result = 0;
+				for (int i = 0 ; i < 4; i++) {
+					float c0 = cpu_madd(unorm8(t10, i * 8) - unorm8(t00, i * 8), fx, unorm8(t00, i * 8));
+					float c1 = cpu_madd(unorm8(t11, i * 8) - unorm8(t01, i * 8), fx, unorm8(t01, i * 8));
+					result |= pack_unorm8(cpu_madd(c1 - c0, fy, c0), i * 8);
+				}
+				dst[x] = result;
+			}
+		});
+	}
+};
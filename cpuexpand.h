@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) 2020 gyabo <gyaboyan@gmail.com>
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+#pragma once
+
+//
+// CPU version of update_buffer.glsl : object_format -> 6 x vertex_format.
+// expand_objects_ref() is the scalar reference, expand_objects_avx2() does
+// 8 objects per iteration and streams whole vertices into dst, which is
+// meant to be a mapped (write combined) vertex buffer.
+// Both share the same sincos polynomial and operation order, and every
+// multiply-add goes through expand_madd/expand_madd8, which is one fused
+// operation when the target has FMA and a separate mul and add otherwise,
+// so the compiler has nothing left to contract and the results are bit
+// identical with any flags (expand_check.cpp compares them). Invalid objects and objects whose bounding
+// circle is outside of clip space are compacted away like the compute
+// shader does, the return value is the number of expanded objects.
+//
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif //__AVX2__
+
+#ifdef _MSC_VER
+#pragma fp_contract(off)
+#endif //_MSC_VER
+
+//a * b + c
+static inline float
+expand_madd(float a, float b, float c)
+{
+#ifdef __FMA__
+	return (fmaf(a, b, c));
+#else
+	return (a * b + c);
+#endif //__FMA__
+}
+
+//cephes sinf/cosf, enough for |a| < 8192.
+static inline void
+expand_sincos(float a, float & s, float & c)
+{
+	float x = fabsf(a);
+	int32_t j = int32_t(x * 1.27323954473516f);
+	j = (j + 1) & ~1;
+	float y = float(j);
+	bool sign_s = signbit(a) != ((j & 4) != 0);
+	bool sign_c = ((j - 2) & 4) == 0;
+
+	x = expand_madd(y, -0.78515625f, x);
+	x = expand_madd(y, -2.4187564849853515625e-4f, x);
+	x = expand_madd(y, -3.77489497744594108e-8f, x);
+	float z = x * x;
+	float pc = expand_madd(2.443315711809948e-5f, z, -1.388731625493765e-3f);
+	pc = expand_madd(pc, z, 4.166664568298827e-2f);
+	pc = expand_madd(pc * z, z, -0.5f * z) + 1.0f;
+	float ps = expand_madd(-1.9515295891e-4f, z, 8.3321608736e-3f);
+	ps = expand_madd(ps, z, -1.6666654611e-1f);
+	ps = expand_madd(ps * z, x, x);
+	bool is_swap = (j & 2) != 0;
+	s = is_swap ? pc : ps;
+	c = is_swap ? ps : pc;
+	if (sign_s)
+		s = -s;
+	if (sign_c)
+		c = -c;
+}
+
+template<typename object_format, typename vertex_format>
+inline uint32_t
+expand_objects_ref(
+	const object_format *src,
+	vertex_format *dst,
+	uint32_t count)
+{
+	uint32_t ret = 0;
+	//triangle list : 0 1 2, 1 3 2
+	static const int order[6] = {0, 1, 2, 1, 3, 2};
+	static const float corner[4][2] = {{-1, -1}, {-1, 1}, {1, -1}, {1, 1}};
+	static const float uvcorner[4][2] = {{0, 0}, {0, 1}, {1, 0}, {1, 1}};
+
+	for (uint32_t tid = 0; tid < count; tid++) {
+		auto & obj = src[tid];
+		if (obj.metadata[0] == 0)
+			continue;
+		float radius = sqrtf(expand_madd(obj.scale[0], obj.scale[0], obj.scale[1] * obj.scale[1]));
+		if (fabsf(obj.pos[0]) - radius > 1.0f || fabsf(obj.pos[1]) - radius > 1.0f)
+			continue;
+
+		float s, c;
+		expand_sincos(obj.rotate[0], s, c);
+		float uv_unit[2] = { 1.0f / obj.uvinfo[2], 1.0f / obj.uvinfo[3] };
+		float uv_offset[2] = { uv_unit[0] * obj.uvinfo[0], uv_unit[1] * obj.uvinfo[1] };
+		float basepos[4][2];
+		float baseuv[4][2];
+		for (int i = 0 ; i < 4; i++) {
+			float x = corner[i][0] * obj.scale[0];
+			float y = corner[i][1] * obj.scale[1];
+			basepos[i][0] = expand_madd(x, c, -(y * s)) + obj.pos[0];
+			basepos[i][1] = expand_madd(x, s, y * c) + obj.pos[1];
+			baseuv[i][0] = expand_madd(uvcorner[i][0], uv_unit[0], uv_offset[0]);
+			baseuv[i][1] = expand_madd(uvcorner[i][1], uv_unit[1], uv_offset[1]);
+		}
+		for (int i = 0 ; i < 6; i++) {
+			auto & vtx = dst[ret * 6 + i];
+			int k = order[i];
+			vtx.pos[0] = basepos[k][0];
+			vtx.pos[1] = basepos[k][1];
+			vtx.pos[2] = 0.0f;
+			vtx.pos[3] = 1.0f;
+			vtx.uv[0] = baseuv[k][0];
+			vtx.uv[1] = baseuv[k][1];
+			vtx.uv[2] = 0.0f;
+			vtx.uv[3] = 1.0f;
+			memcpy(vtx.color, obj.color, sizeof(vtx.color));
+			vtx.matid = obj.metadata[1];
+			memset(vtx.reserved, 0, sizeof(vtx.reserved));
+		}
+		ret++;
+	}
+
+	return (ret);
+}
+
+#ifdef __AVX2__
+//a * b + c, see expand_madd.
+static inline __m256
+expand_madd8(__m256 a, __m256 b, __m256 c)
+{
+#ifdef __FMA__
+	return (_mm256_fmadd_ps(a, b, c));
+#else
+	return (_mm256_add_ps(_mm256_mul_ps(a, b), c));
+#endif //__FMA__
+}
+
+static inline void
+expand_sincos8(__m256 a, __m256 & s, __m256 & c)
+{
+	__m256 sign_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x80000000));
+	__m256 x = _mm256_andnot_ps(sign_mask, a);
+	__m256i j = _mm256_cvttps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(1.27323954473516f)));
+	j = _mm256_and_si256(_mm256_add_epi32(j, _mm256_set1_epi32(1)), _mm256_set1_epi32(~1));
+	__m256 y = _mm256_cvtepi32_ps(j);
+	__m256i four = _mm256_set1_epi32(4);
+	__m256 swap_sign_s = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(j, four), 29));
+	__m256 sign_s = _mm256_xor_ps(_mm256_and_ps(a, sign_mask), swap_sign_s);
+	__m256i jc = _mm256_sub_epi32(j, _mm256_set1_epi32(2));
+	__m256 sign_c = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_andnot_si256(jc, four), 29));
+	__m256 is_swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(j, _mm256_set1_epi32(2)), _mm256_set1_epi32(2)));
+
+	x = expand_madd8(y, _mm256_set1_ps(-0.78515625f), x);
+	x = expand_madd8(y, _mm256_set1_ps(-2.4187564849853515625e-4f), x);
+	x = expand_madd8(y, _mm256_set1_ps(-3.77489497744594108e-8f), x);
+	__m256 z = _mm256_mul_ps(x, x);
+
+	__m256 pc = expand_madd8(_mm256_set1_ps(2.443315711809948e-5f), z, _mm256_set1_ps(-1.388731625493765e-3f));
+	pc = expand_madd8(pc, z, _mm256_set1_ps(4.166664568298827e-2f));
+	pc = expand_madd8(_mm256_mul_ps(pc, z), z, _mm256_mul_ps(_mm256_set1_ps(-0.5f), z));
+	pc = _mm256_add_ps(pc, _mm256_set1_ps(1.0f));
+
+	__m256 ps = expand_madd8(_mm256_set1_ps(-1.9515295891e-4f), z, _mm256_set1_ps(8.3321608736e-3f));
+	ps = expand_madd8(ps, z, _mm256_set1_ps(-1.6666654611e-1f));
+	ps = expand_madd8(_mm256_mul_ps(ps, z), x, x);
+
+	s = _mm256_xor_ps(_mm256_blendv_ps(ps, pc, is_swap), sign_s);
+	c = _mm256_xor_ps(_mm256_blendv_ps(pc, ps, is_swap), sign_c);
+}
+
+template<typename object_format, typename vertex_format>
+inline uint32_t
+expand_objects_avx2(
+	const object_format *src,
+	vertex_format *dst,
+	uint32_t count)
+{
+	uint32_t ret = 0;
+	static_assert(sizeof(object_format) == 96, "object_format layout");
+	static_assert(sizeof(vertex_format) == 64, "vertex_format layout");
+	static const int order[6] = {0, 1, 2, 1, 3, 2};
+	static const float corner[4][2] = {{-1, -1}, {-1, 1}, {1, -1}, {1, 1}};
+	static const float uvcorner[4][2] = {{0, 0}, {0, 1}, {1, 0}, {1, 1}};
+	const int stride = sizeof(object_format) / sizeof(float);
+	const __m256i lane_offset = _mm256_mullo_epi32(
+			_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+	bool is_aligned = ((uintptr_t)dst & 31) == 0;
+
+	uint32_t last = count & ~7u;
+	for (uint32_t tid = 0; tid < last; tid += 8) {
+		const float *base = (const float *)&src[tid];
+		__m256i valid = _mm256_i32gather_epi32((const int *)base + 20, lane_offset, 4);
+		int valid_mask = _mm256_movemask_ps(_mm256_castsi256_ps(
+					_mm256_cmpeq_epi32(valid, _mm256_setzero_si256()))) ^ 0xFF;
+		if (valid_mask == 0)
+			continue;
+
+		__m256 pos_x = _mm256_i32gather_ps(base + 0, lane_offset, 4);
+		__m256 pos_y = _mm256_i32gather_ps(base + 1, lane_offset, 4);
+		__m256 scale_x = _mm256_i32gather_ps(base + 4, lane_offset, 4);
+		__m256 scale_y = _mm256_i32gather_ps(base + 5, lane_offset, 4);
+
+		//bounding circle culling, same as the scalar path.
+		__m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+		__m256 radius = _mm256_sqrt_ps(expand_madd8(scale_x, scale_x, _mm256_mul_ps(scale_y, scale_y)));
+		__m256 out_x = _mm256_cmp_ps(_mm256_sub_ps(_mm256_and_ps(pos_x, abs_mask), radius), _mm256_set1_ps(1.0f), _CMP_GT_OQ);
+		__m256 out_y = _mm256_cmp_ps(_mm256_sub_ps(_mm256_and_ps(pos_y, abs_mask), radius), _mm256_set1_ps(1.0f), _CMP_GT_OQ);
+		valid_mask &= ~_mm256_movemask_ps(_mm256_or_ps(out_x, out_y));
+		if (valid_mask == 0)
+			continue;
+		__m256 rot = _mm256_i32gather_ps(base + 8, lane_offset, 4);
+		__m256 uvinfo[4];
+		for (int i = 0 ; i < 4; i++)
+			uvinfo[i] = _mm256_i32gather_ps(base + 16 + i, lane_offset, 4);
+
+		__m256 s, c;
+		expand_sincos8(rot, s, c);
+		__m256 one = _mm256_set1_ps(1.0f);
+		__m256 uv_unit_x = _mm256_div_ps(one, uvinfo[2]);
+		__m256 uv_unit_y = _mm256_div_ps(one, uvinfo[3]);
+		__m256 uv_offset_x = _mm256_mul_ps(uv_unit_x, uvinfo[0]);
+		__m256 uv_offset_y = _mm256_mul_ps(uv_unit_y, uvinfo[1]);
+
+		//soa results, one row per corner.
+		alignas(32) float basepos[4][2][8];
+		alignas(32) float baseuv[4][2][8];
+		for (int i = 0 ; i < 4; i++) {
+			__m256 x = _mm256_mul_ps(_mm256_set1_ps(corner[i][0]), scale_x);
+			__m256 y = _mm256_mul_ps(_mm256_set1_ps(corner[i][1]), scale_y);
+			__m256 neg_ys = _mm256_xor_ps(_mm256_mul_ps(y, s), _mm256_set1_ps(-0.0f));
+			__m256 rx = expand_madd8(x, c, neg_ys);
+			__m256 ry = expand_madd8(x, s, _mm256_mul_ps(y, c));
+			_mm256_store_ps(basepos[i][0], _mm256_add_ps(rx, pos_x));
+			_mm256_store_ps(basepos[i][1], _mm256_add_ps(ry, pos_y));
+			_mm256_store_ps(baseuv[i][0], expand_madd8(_mm256_set1_ps(uvcorner[i][0]), uv_unit_x, uv_offset_x));
+			_mm256_store_ps(baseuv[i][1], expand_madd8(_mm256_set1_ps(uvcorner[i][1]), uv_unit_y, uv_offset_y));
+		}
+
+		//aos : one 64 byte vertex is two 32 byte stores.
+		for (int lane = 0 ; lane < 8; lane++) {
+			if ((valid_mask & (1 << lane)) == 0)
+				continue;
+			auto & obj = src[tid + lane];
+			__m256 attr = _mm256_castps128_ps256(_mm_loadu_ps(obj.color));
+			attr = _mm256_insertf128_ps(attr, _mm_castsi128_ps(_mm_cvtsi32_si128(obj.metadata[1])), 1);
+			float *out = (float *)&dst[ret * 6];
+			for (int i = 0 ; i < 6; i++) {
+				int k = order[i];
+				__m256 posuv = _mm256_setr_ps(
+						basepos[k][0][lane], basepos[k][1][lane], 0.0f, 1.0f,
+						baseuv[k][0][lane], baseuv[k][1][lane], 0.0f, 1.0f);
+				if (is_aligned) {
+					_mm256_stream_ps(out + i * 16 + 0, posuv);
+					_mm256_stream_ps(out + i * 16 + 8, attr);
+				} else {
+					_mm256_storeu_ps(out + i * 16 + 0, posuv);
+					_mm256_storeu_ps(out + i * 16 + 8, attr);
+				}
+			}
+			ret++;
+		}
+	}
+	_mm_sfence();
+	ret += expand_objects_ref(src + last, dst + ret * 6, count - last);
+
+	return (ret);
+}
+#endif //__AVX2__
+
+template<typename object_format, typename vertex_format>
+inline uint32_t
+expand_objects(
+	const object_format *src,
+	vertex_format *dst,
+	uint32_t count)
+{
+#ifdef __AVX2__
+	return expand_objects_avx2(src, dst, count);
+#else
+	return expand_objects_ref(src, dst, count);
+#endif //__AVX2__
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2020 gyabo <gyaboyan@gmail.com>
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// Checks that expand_objects_avx2() writes the same bits as
+// expand_objects_ref() for random objects, including the culled ones and
+// a tail that is not a multiple of 8. Build it with the flags of the
+// renderer (/arch:AVX2, -mavx2 -mfma, -march=native ...).
+// usage : expand_check [count]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <random>
+#include "cpuexpand.h"
+
+//same layouts as vkcontext_t::object_format and vkcontext_t::vertex_format.
+struct object_format {
+	float pos[4];
+	float scale[4];
+	float rotate[4];
+	float color[4];
+	float uvinfo[4];
+	uint32_t metadata[4];
+};
+
+struct vertex_format {
+	float pos[4];
+	float uv[4];
+	float color[4];
+	uint32_t matid;
+	uint32_t reserved[3];
+};
+
+int
+main(int argc, char *argv[])
+{
+#ifndef __AVX2__
+	(void)argc;
+	(void)argv;
+	printf("expand_check : built without AVX2, nothing to compare\n");
+	return (0);
+#else
+	uint32_t count = argc > 1 ? atoi(argv[1]) : 8197;
+	std::minstd_rand rng(1);
+	auto frand = [&](float lo, float hi) {
+		return lo + (hi - lo) * float(rng() & 0xFFFFFF) / float(0xFFFFFF);
+	};
+	std::vector<object_format> vobjects(count);
+	for (auto & obj : vobjects) {
+		obj = {};
+		obj.pos[0] = frand(-1.5f, 1.5f);
+		obj.pos[1] = frand(-1.5f, 1.5f);
+		obj.scale[0] = frand(0.0f, 0.25f);
+		obj.scale[1] = frand(0.0f, 0.25f);
+		obj.rotate[0] = frand(-64.0f, 64.0f);
+		for (auto & c : obj.color)
+			c = frand(0.0f, 1.0f);
+		obj.uvinfo[0] = float(rng() % 16);
+		obj.uvinfo[1] = float(rng() % 16);
+		obj.uvinfo[2] = float(1 + rng() % 16);
+		obj.uvinfo[3] = float(1 + rng() % 16);
+		obj.metadata[0] = (rng() % 8) != 0;
+		obj.metadata[1] = rng() & 0xFFFF;
+	}
+
+	std::vector<vertex_format> vref(count * 6);
+	std::vector<vertex_format> vavx2(count * 6);
+	uint32_t ref_count = expand_objects_ref(vobjects.data(), vref.data(), count);
+	uint32_t avx2_count = expand_objects_avx2(vobjects.data(), vavx2.data(), count);
+	if (ref_count != avx2_count) {
+		printf("expand_check : count ref=%d avx2=%d\n", ref_count, avx2_count);
+		return (1);
+	}
+
+	uint32_t mismatch = 0;
+	for (uint32_t i = 0 ; i < ref_count * 6; i++) {
+		if (memcmp(&vref[i], &vavx2[i], sizeof(vertex_format)) == 0)
+			continue;
+		if (mismatch++ < 8) {
+			printf("vertex %d : pos ref=(%.9g %.9g) avx2=(%.9g %.9g) uv ref=(%.9g %.9g) avx2=(%.9g %.9g)\n", i,
+				vref[i].pos[0], vref[i].pos[1], vavx2[i].pos[0], vavx2[i].pos[1],
+				vref[i].uv[0], vref[i].uv[1], vavx2[i].uv[0], vavx2[i].uv[1]);
+		}
+	}
+	printf("expand_check : %d objects, %d expanded, %d vertices differ\n", count, ref_count, mismatch);
+	return (mismatch ? 1 : 0);
+#endif //__AVX2__
+}
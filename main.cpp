@@ -20,12 +20,19 @@
  *
  */
 #define VKWIN32_DEBUG
+#include <chrono>
+#include <thread>
+#include <random>
+#include <stdlib.h>
 #include "vkcontext.h"
+#include "cpucontext.h"
+#include "atlas.h"
 
 inline void
 fork_process_wait(
 	const char *command)
 {
+#ifdef _WIN32
 	PROCESS_INFORMATION pi;
 
 	STARTUPINFO si = {};
@@ -41,6 +48,10 @@ fork_process_wait(
 	while (WaitForSingleObject(pi.hProcess, 0) != WAIT_OBJECT_0) {
 		Sleep(1);
 	}
+#else
+	if (system(command) != 0)
+		printf("failed command:\n%s\n\n", command);
+#endif //_WIN32
 }
 
 inline void
@@ -94,9 +105,10 @@ compile_glsl2spirv(
 			fclose(fp);
 		}
 	}
-	DeleteFile(tempfilename.c_str());
+	remove(tempfilename.c_str());
 }
 
+#ifdef _WIN32
 static LRESULT WINAPI
 window_proc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 {
@@ -171,6 +183,21 @@ window_update()
 	}
 	return is_active;
 }
+#else
+//no window system : the sample only runs with -headless.
+[[ nodiscard ]]
+static HWND
+init_window(const char *name, int w, int h)
+{
+	return (nullptr);
+}
+
+static int
+window_update()
+{
+	return (0);
+}
+#endif //_WIN32
 
 static void
 compile_glsl2spirv_ex(
@@ -185,9 +212,86 @@ int
 main(int argc, char *argv[])
 {
 	const char *appname = argv[0];
+	bool is_headless = false;
+	bool is_cpu_expand = false;
+	bool is_pull = false;
+	bool is_sorted = false;
+	bool is_instanced = false;
+	bool is_atlas = false;
+	bool is_mips = false;
+	bool is_async_transfer = true;
+	bool is_retained = false;
+	bool is_dynamic = false;
+	bool is_single_pass = false;
+	bool is_compute_composite = false;
+	bool is_cpu_check = false;
+	uint32_t thread_count = 1;
+	uint32_t frames_in_flight = 2;
+	uint32_t frame_latency = 0;
+	uint32_t present_mode = vkcontext_t::PRESENT_MODE_FIFO;
+	const char *pack_path = nullptr;
+	VkFormat user_image_format = VK_FORMAT_R8G8B8A8_UNORM;
+	uint32_t vertex_format = vkcontext_t::VERTEX_FORMAT_FLOAT;
+	uint64_t headless_frame_max = 1000;
+
+	for (int i = 1 ; i < argc; i++) {
+		if (std::string(argv[i]) == "-headless")
+			is_headless = true;
+		if (std::string(argv[i]) == "-cpuexpand")
+			is_cpu_expand = true;
+		if (std::string(argv[i]) == "-pull")
+			is_pull = true;
+		if (std::string(argv[i]) == "-instanced")
+			is_instanced = true;
+		if (std::string(argv[i]) == "-sort")
+			is_sorted = true;
+		if (std::string(argv[i]) == "-atlas")
+			is_atlas = true;
+		if (std::string(argv[i]) == "-mips")
+			is_mips = true;
+		if (std::string(argv[i]) == "-frames" && i + 1 < argc)
+			frames_in_flight = atoi(argv[++i]);
+		if (std::string(argv[i]) == "-latency" && i + 1 < argc)
+			frame_latency = atoi(argv[++i]);
+		if (std::string(argv[i]) == "-mailbox")
+			present_mode = vkcontext_t::PRESENT_MODE_MAILBOX;
+		if (std::string(argv[i]) == "-immediate")
+			present_mode = vkcontext_t::PRESENT_MODE_IMMEDIATE;
+		if (std::string(argv[i]) == "-threads" && i + 1 < argc)
+			thread_count = atoi(argv[++i]);
+		if (std::string(argv[i]) == "-singlepass")
+			is_single_pass = true;
+		if (std::string(argv[i]) == "-compute")
+			is_compute_composite = true;
+		if (std::string(argv[i]) == "-dynamic")
+			is_dynamic = true;
+		if (std::string(argv[i]) == "-retained")
+			is_retained = true;
+		if (std::string(argv[i]) == "-cpucheck")
+			is_cpu_check = true;
+		if (std::string(argv[i]) == "-syncupload")
+			is_async_transfer = false;
+		if (std::string(argv[i]) == "-pack" && i + 1 < argc)
+			pack_path = argv[++i];
+		if (std::string(argv[i]) == "-bc1")
+			user_image_format = VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+		if (std::string(argv[i]) == "-bc3")
+			user_image_format = VK_FORMAT_BC3_UNORM_BLOCK;
+		if (std::string(argv[i]) == "-bc7")
+			user_image_format = VK_FORMAT_BC7_UNORM_BLOCK;
+		if (std::string(argv[i]) == "-packed")
+			vertex_format = vkcontext_t::VERTEX_FORMAT_PACKED_FLOAT;
+		if (std::string(argv[i]) == "-half")
+			vertex_format = vkcontext_t::VERTEX_FORMAT_PACKED_HALF;
+	}
+#ifndef _WIN32
+	//vkcontext_t falls back to headless as well, the frame loop has to follow.
+	is_headless = true;
+#endif //_WIN32
 
 	auto frand = []() {
-		return float(rand()) / float(0x7FFF);
+		//RAND_MAX is 0x7FFF only on Windows.
+		return float(rand() & 0x7FFF) / float(0x7FFF);
 	};
 	auto frandom = [ = ]() {
 		return frand() * 2.0f - 1.0f;
@@ -201,27 +305,68 @@ main(int argc, char *argv[])
 	cinfo.ScreenW = 1024;
 	cinfo.ScreenH = 1024;
 	cinfo.FrameFifoMax = 2;
+	cinfo.FramesInFlight = frames_in_flight;
+	cinfo.FrameLatency = frame_latency;
+	cinfo.PresentMode = present_mode;
 	cinfo.Width = 480;
 	cinfo.Height = 640;
 	cinfo.BitsSize = 4;
 	cinfo.LayerMax = 4;
 	cinfo.UserImageMax = 32;
 	cinfo.ObjectMax = 8192;
+	cinfo.WorkgroupSize = 64;
 	cinfo.DescriptorArrayMax = 32;
 	cinfo.GpuMemoryMax = 256 * 1024 * 1024;
 
 	std::string shaderpath = "./shaders/";
 	compile_glsl2spirv(shaderpath + "update_buffer.glsl", "_CS_", cinfo.cs_update);
+	compile_glsl2spirv(shaderpath + "draw_object.glsl", "_VS_", cinfo.vs_pull);
+	compile_glsl2spirv(shaderpath + "sort_objects.glsl", "_CS_", cinfo.cs_sort);
+	compile_glsl2spirv(shaderpath + "mip_generate.glsl", "_CS_", cinfo.cs_mip);
+	compile_glsl2spirv(shaderpath + "composite.glsl", "_CS_", cinfo.cs_composite);
 	compile_glsl2spirv_ex(shaderpath + "draw_rect.glsl", shader_draw_rect);
 	compile_glsl2spirv_ex(shaderpath + "present.glsl", shader_present);
+	shader_draw_rect.is_sorted = is_sorted;
 	for (int i = 0 ; i < cinfo.LayerMax - 1; i++)
 		cinfo.shader_layers.push_back(shader_draw_rect);
 	cinfo.shader_layers.push_back(shader_present);
 
 	cinfo.appname = argv[0];
-	cinfo.hwnd = init_window(cinfo.appname, cinfo.ScreenW, cinfo.ScreenH);
+	cinfo.Headless = is_headless;
+	cinfo.CpuExpand = is_cpu_expand;
+	cinfo.DrawMode = is_pull ? vkcontext_t::DRAW_MODE_PULL : vkcontext_t::DRAW_MODE_EXPAND;
+	if (is_instanced)
+		cinfo.DrawMode = vkcontext_t::DRAW_MODE_INSTANCED;
+	cinfo.VertexFormat = vertex_format;
+	cinfo.UserImageMips = is_mips;
+	cinfo.AsyncTransfer = is_async_transfer;
+	cinfo.DynamicCommands = is_dynamic;
+	cinfo.SinglePass = is_single_pass;
+	cinfo.ComputeComposite = is_compute_composite;
+	if (!is_headless)
+		cinfo.hwnd = init_window(cinfo.appname, cinfo.ScreenW, cinfo.ScreenH);
+#ifdef _WIN32
 	cinfo.hinst = GetModuleHandle(NULL);
+#endif //_WIN32
 	ctx.init(cinfo);
+
+	//-cpucheck : cpucontext_t renders the last headless frame too, with the same textures.
+	cpucontext_t cpu;
+	if (is_cpu_check && (!is_headless || thread_count > 1)) {
+		printf("-cpucheck needs -headless and a single thread\n");
+		is_cpu_check = false;
+	}
+	if (is_cpu_check) {
+		cpucontext_t::create_info info = {};
+		info.ScreenW = cinfo.ScreenW;
+		info.ScreenH = cinfo.ScreenH;
+		info.Width = cinfo.Width;
+		info.Height = cinfo.Height;
+		info.ObjectMax = cinfo.ObjectMax;
+		info.LayerMax = cinfo.LayerMax;
+		info.UserImageMax = cinfo.UserImageMax;
+		cpu.init(info);
+	}
 	{
 		std::vector<uint32_t> testtex;
 		for (int y = 0; y < 256; y++) {
@@ -230,16 +375,130 @@ main(int argc, char *argv[])
 				testtex.push_back(x ^ y);
 			}
 		}
-		ctx.upload_user_image(0, 256, 256, testtex.data());
-		ctx.upload_user_image(1, 256, 256, testtex.data());
+		uint32_t bc_format = vkcontext_t::get_bc_format(user_image_format);
+		if (bc_format != UINT32_MAX) {
+			std::vector<uint8_t> blocks(bc_image_bytes(bc_format, 256, 256));
+			bc_encode_image(bc_format, 256, 256, testtex.data(), blocks.data());
+			ctx.upload_user_image(0, 256, 256, blocks.data(), user_image_format);
+		} else {
+			ctx.upload_user_image(0, 256, 256, testtex.data());
+		}
+		ctx.set_user_image_source(1, 256, 256, [ = ](void *dst) {
+			memcpy(dst, testtex.data(), testtex.size() * sizeof(uint32_t));
+		}, user_image_format);
+		if (is_cpu_check) {
+			cpu.upload_user_image(0, 256, 256, testtex.data());
+			cpu.upload_user_image(1, 256, 256, testtex.data());
+		}
+	}
+
+	//the entries of the pack replace the test textures from slot 0.
+	assetpack_t pack;
+	if (pack_path && pack.open(pack_path))
+		for (uint32_t i = 0 ; i < pack.count() && i < cinfo.UserImageMax; i++)
+			ctx.upload_asset(i, pack, pack.entries[i].name);
+
+	//test : small sprites of random size packed into the slots 2..
+	atlas_t atlas;
+	std::vector<atlas_t::handle_t> atlas_handles;
+	if (is_atlas) {
+		atlas.init(1024, 2, cinfo.UserImageMax - 2);
+		for (int i = 0 ; i < 256; i++) {
+			uint32_t w = 8 + rand() % 56;
+			uint32_t h = 8 + rand() % 56;
+			uint32_t color = 0xFF000000 | ((rand() & 0xFFFF) << 8) | (rand() & 0xFF);
+			std::vector<uint32_t> sprite;
+			for (uint32_t y = 0; y < h; y++)
+				for (uint32_t x = 0; x < w; x++)
+					sprite.push_back(((x ^ y) & 4) ? color : 0xFFFFFFFF);
+			atlas_t::handle_t handle;
+			if (atlas.add(w, h, sprite.data(), handle))
+				atlas_handles.push_back(handle);
+		}
+		atlas.upload(ctx);
+		if (is_cpu_check)
+			atlas.upload(cpu, true);
 	}
 	ctx.create_cmdbuf();
 
-	printf("START\n");
-	uint64_t frame_count = 0;
+	//retained : the layers written once are drawn once per frame in flight.
+	for (int i = 1 ; is_retained && i < cinfo.LayerMax - 1; i++)
+		ctx.set_layer_static(i, true);
+
 	double phase = 0.0;
 	static int tex_id = 20;
-	while (window_update()) {
+
+	//frand : [0, 1] of the calling thread.
+	auto fill_object = [&](vkcontext_t::object_format * p, int i, auto && frand) {
+		auto frandom = [&]() {
+			return frand() * 2.0f - 1.0f;
+		};
+		p->metadata[0] = 1;
+		p->pos[0] = cos(3 * cos(123.0f * frandom() + frandom() * phase * 2.0 * 0.05));
+		p->pos[1] = cos(3 * sin(456.0f * frandom() + frandom() * phase * 3.0 * 0.05));
+		p->pos[2] = frand();
+		p->scale[0] = 0.1 + frand() * 0.05;
+		p->scale[1] = 0.001 + frand() * 0.05;
+		p->rotate[0] = frandom() * 10.0 + phase * 5.0;
+		p->color[0] = frand();
+		p->color[1] = frand();
+		p->color[2] = frand();
+		p->color[3] = 1.0;
+
+		//for test 8x8 tex
+		p->uvinfo[0] = tex_id % 8;
+		p->uvinfo[1] = tex_id / 8;
+		p->uvinfo[2] = 8;
+		p->uvinfo[3] = 8;
+
+		//all
+		p->uvinfo[0] = 0;
+		p->uvinfo[1] = 0;
+		p->uvinfo[2] = 1;
+		p->uvinfo[3] = 1;
+
+		if (!atlas_handles.empty())
+			atlas_handles[i % atlas_handles.size()].apply(*p);
+	};
+
+	//test : every thread pushes its share of each layer through a sprite_writer_t.
+	auto fill_layers_threaded = [&]() {
+		std::vector<std::thread> vthread;
+		for (uint32_t t = 0 ; t < thread_count; t++) {
+			vthread.emplace_back([&, t]() {
+				std::minstd_rand rng(t + 1);
+				auto trand = [&]() {
+					return float(rng() & 0x7FFF) / float(0x7FFF);
+				};
+				//the writer reserves no more than the share of this thread.
+				uint32_t share = (cinfo.ObjectMax - t + thread_count - 1) / thread_count;
+				for (int i = 0 ; i < cinfo.LayerMax - 1; i++) {
+					vkcontext_t::sprite_writer_t writer(ctx, i, share);
+					for (int n = t; n < cinfo.ObjectMax; n += thread_count) {
+						auto p = writer.push();
+						if (!p)
+							break;
+						fill_object(p, n, trand);
+					}
+				}
+			});
+		}
+		for (auto & th : vthread)
+			th.join();
+
+		//the single thread fill draws ObjectMax objects per layer, the threads must not lose any.
+		for (int i = 0 ; i < cinfo.LayerMax - 1; i++) {
+			uint32_t count = ctx.get_sprite_count(i);
+			if (count != cinfo.ObjectMax)
+				printf("threads : layer %d has %d objects, the single thread fill has %d\n", i, count, cinfo.ObjectMax);
+		}
+	};
+
+	printf("START\n");
+	uint64_t frame_count = 0;
+	auto start_time = std::chrono::steady_clock::now();
+	while (is_headless ? frame_count < headless_frame_max : window_update()) {
+#ifdef _WIN32
 		if (GetAsyncKeyState(VK_DOWN) & 0x0001) {
 			tex_id--;
 			if (tex_id < 0)
@@ -248,38 +507,26 @@ main(int argc, char *argv[])
 		if (GetAsyncKeyState(VK_UP) & 0x0001) {
 			tex_id++;
 		}
+#endif //_WIN32
+		ctx.begin_frame();
 		phase += 0.01;
 		srand(0);
-		for (int i = 0 ; i < cinfo.LayerMax - 1; i++) {
-			auto p = ctx.get_object_format_address(i);
-			for (int i = 0 ; i < cinfo.ObjectMax; i++) {
-				p->metadata[0] = 1;
-				p->pos[0] = cos(3 * cos(123.0f * frandom() + frandom() * phase * 2.0 * 0.05));
-				p->pos[1] = cos(3 * sin(456.0f * frandom() + frandom() * phase * 3.0 * 0.05));
-				p->scale[0] = 0.1 + frand() * 0.05;
-				p->scale[1] = 0.001 + frand() * 0.05;
-				p->rotate[0] = frandom() * 10.0 + phase * 5.0;
-				p->color[0] = frand();
-				p->color[1] = frand();
-				p->color[2] = frand();
-				p->color[3] = 1.0;
-
-				//for test 8x8 tex
-				p->uvinfo[0] = tex_id % 8;
-				p->uvinfo[1] = tex_id / 8;
-				p->uvinfo[2] = 8;
-				p->uvinfo[3] = 8;
-
-				//all
-				p->uvinfo[0] = 0;
-				p->uvinfo[1] = 0;
-				p->uvinfo[2] = 1;
-				p->uvinfo[3] = 1;
-
-
-				p++;
+		bool is_threaded = thread_count > 1 && !is_retained;
+		if (is_threaded)
+			fill_layers_threaded();
+		for (int i = 0 ; !is_threaded && i < cinfo.LayerMax - 1; i++) {
+			//retained : the layers other than the first are written once.
+			if (is_retained && i > 0 && frame_count > 0)
+				continue;
+			auto p = is_retained ? ctx.get_retained_objects(i) : ctx.get_object_format_address(i);
+			for (int i = 0 ; i < cinfo.ObjectMax; i++)
+				fill_object(p++, i, frand);
+			if (is_retained) {
+				ctx.mark_objects_dirty(i, 0, cinfo.ObjectMax);
+				ctx.set_retained_object_count(i, cinfo.ObjectMax);
+			} else {
+				ctx.draw_triangles(i, cinfo.ObjectMax * 6);
 			}
-			ctx.draw_triangles(i, cinfo.ObjectMax * 6);
 		}
 		auto last_index = cinfo.LayerMax - 1;
 		auto p = ctx.get_object_format_address(last_index);
@@ -294,11 +541,47 @@ main(int argc, char *argv[])
 		p->uvinfo[2] = 1;
 		p->uvinfo[3] = 1;
 		ctx.draw_triangles(last_index, 6);
-		ctx.submit();
+		if (is_cpu_check && frame_count + 1 == headless_frame_max) {
+			for (int i = 0 ; i < cinfo.LayerMax; i++) {
+				bool is_full = i < last_index;
+				auto src = is_retained && is_full ? ctx.get_retained_objects(i) : ctx.get_object_format_address(i);
+				memcpy(cpu.get_object_format_address(i), src, (is_full ? cinfo.ObjectMax : 1) * sizeof(*src));
+				cpu.draw_triangles(i, is_full ? cinfo.ObjectMax * 6 : 6);
+			}
+			cpu.submit();
+		}
+		ctx.end_frame();
 
 		frame_count++;
 		if ((frame_count % 60) == 0) {
-			printf("frame_count=%lld\n", frame_count);
+			printf("frame_count=%lld wait begin=%.3fms end=%.3fms\n", frame_count,
+				ctx.frame_stats.begin_wait_ns * 1e-6, ctx.frame_stats.end_wait_ns * 1e-6);
+		}
+	}
+	if (is_headless) {
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+		printf("headless : %lld frames %.3f sec %.2f fps\n", frame_count, elapsed.count(), double(frame_count) / elapsed.count());
+		printf("cpu wait : begin_frame %.3f sec end_frame %.3f sec\n",
+			ctx.frame_stats.begin_wait_total_ns * 1e-9, ctx.frame_stats.end_wait_total_ns * 1e-9);
+		if (is_dynamic)
+			printf("dynamic : %lld command buffers recorded, %lld layers skipped\n", ctx.cmdbuf_record_count, ctx.layer_skip_count);
+		if (is_retained)
+			printf("retained : %lld bytes copied\n", ctx.retained_upload_bytes);
+	}
+	if (is_cpu_check && frame_count > 0) {
+		//filtering and blending may round differently on the GPU, count the bytes off by more than 2.
+		std::vector<uint32_t> gpu_output;
+		ctx.read_output_image(gpu_output);
+		const uint8_t *a = (const uint8_t *)gpu_output.data();
+		const uint8_t *b = (const uint8_t *)cpu.get_output_address();
+		uint32_t diff_count = 0;
+		int diff_max = 0;
+		for (size_t i = 0 ; i < gpu_output.size() * sizeof(uint32_t); i++) {
+			int diff = abs(int(a[i]) - int(b[i]));
+			diff_max = std::max(diff_max, diff);
+			if (diff > 2)
+				diff_count++;
 		}
+		printf("cpucheck : %d bytes differ by more than 2, max difference %d\n", diff_count, diff_max);
 	}
 }
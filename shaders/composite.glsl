@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2020 gyabo <gyaboyan@gmail.com>
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+#version 450 core
+#extension GL_EXT_nonuniform_qualifier : enable
+
+//
+// final output in one dispatch instead of the present layer pass and the blit.
+// every thread writes one texel of the ScreenW x ScreenH output (a swapchain
+// image or the headless target) with the sum of the layers at its uv, the same
+// as present.glsl (which sums the LayerIndex layers below the last one), so the
+// Width x Height -> ScreenW x ScreenH scale is done by the linear sampler. the output has no format qualifier, its view decides
+// the channel order (B8G8R8A8 for the swapchain).
+//
+
+layout(set=0, binding=0) uniform sampler2D tex[];
+
+layout(set=1, binding=0) writeonly uniform image2D out_image;
+
+//vkcontext_t::composite_push_t
+layout(push_constant) uniform push_t {
+	uint first_layer;
+	uint layer_count;
+	uint reserved[2];
+} push;
+
+layout(local_size_x=8, local_size_y=8, local_size_z=1) in;
+
+void main()
+{
+	ivec2 pos = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = imageSize(out_image);
+	if(any(greaterThanEqual(pos, size)))
+		return;
+
+	vec2 uv = (vec2(pos) + 0.5) / vec2(size);
+	vec3 color = vec3(0.0);
+	for(uint i = 0; i < push.layer_count; i++)
+		color += textureLod(tex[push.first_layer + i], uv, 0.0).xyz;
+	imageStore(out_image, pos, vec4(color, 1.0));
+}
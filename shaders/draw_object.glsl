@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2020 gyabo <gyaboyan@gmail.com>
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+#version 450 core
+#extension GL_EXT_nonuniform_qualifier : enable
+
+//vertex pulling : vertex shader only, the fragment shader comes from the
+//layer. Corners are computed like update_buffer.glsl.
+//DRAW_MODE_PULL : triangle list, object = gl_VertexIndex / 6.
+//DRAW_MODE_INSTANCED : 4 vertex triangle strip, object = gl_InstanceIndex.
+
+struct object_data {
+	vec4 pos;
+	vec4 scale;
+	vec4 rotate;
+	vec4 color;
+	vec4 uvinfo;
+	uint metadata[4];
+};
+
+layout(std430, set=2, binding=0) readonly buffer obj_t {
+	object_data obj[];
+};
+
+#ifdef _VS_
+layout(location=0) out vec4 v_pos;
+layout(location=1) out vec2 v_uv;
+layout(location=2) out vec4 v_color;
+layout(location=3) flat out uint v_matid;
+
+vec2 rotate(vec2 p, float a) {
+	float c = cos(a);
+	float s = sin(a);
+	return vec2(
+		p.x * c - p.y * s,
+		p.x * s + p.y * c);
+}
+
+//triangle list : 0 1 2, 1 3 2. the strip 0 1 2 3 gives the same triangles.
+const uint corner_index[6] = uint[](0, 1, 2, 1, 3, 2);
+
+layout(constant_id=0) const bool Instanced = false;
+
+void main()
+{
+	uint tid = gl_VertexIndex / 6;
+	uint corner = corner_index[gl_VertexIndex % 6];
+	if(Instanced) {
+		tid = gl_InstanceIndex;
+		corner = gl_VertexIndex;
+	}
+
+	v_pos = vec4(0.0);
+	v_uv = vec2(0.0);
+	v_color = vec4(0.0);
+	v_matid = 0;
+
+	//invalid or outside of clip space : all 6 vertices collapse to one point.
+	vec4 pos = obj[tid].pos;
+	vec4 scale = obj[tid].scale;
+	bool is_visible = all(lessThanEqual(abs(pos.xy) - length(scale.xy), vec2(1.0)));
+	if(obj[tid].metadata[0] == 0 || !is_visible) {
+		gl_Position = vec4(-2.0, -2.0, 0.0, 1.0);
+		return;
+	}
+
+	vec4 uvinfo = obj[tid].uvinfo;
+	vec2 cuv = vec2(corner >> 1, corner & 1);
+
+	vec2 uv_div = uvinfo.zw;
+	vec2 uv_unit = 1.0 / uv_div;
+	vec2 uv_offset = uv_unit * uvinfo.xy;
+	vec2 basepos = (cuv * 2.0 - 1.0) * scale.xy;
+	basepos = rotate(basepos, obj[tid].rotate.x) + pos.xy;
+
+	v_pos = vec4(basepos, 0, 1);
+	v_uv = (cuv / uv_div) + uv_offset;
+	v_color = obj[tid].color;
+	v_matid = obj[tid].metadata[1];
+	gl_Position = v_pos;
+}
+#endif //_VS_
@@ -26,6 +26,7 @@ layout(set=0, binding=0) uniform sampler2D tex[];
 layout(set=0, binding=2) uniform sampler2D tex_user[];
 
 #ifdef _VS_
+//packed vertex formats fill the missing components with (0, 0, 0, 1).
 layout(location=0) in vec4 position;
 layout(location=1) in vec4 uv;
 layout(location=2) in vec4 color;
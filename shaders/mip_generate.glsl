@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2020 gyabo <gyaboyan@gmail.com>
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+#version 450 core
+
+//
+// mip chain of one RGBA8 user image in a single dispatch.
+// every workgroup reduces a 32x32 tile of level 0 to one texel of level 5
+// through shared memory and writes the levels 1..5 of its tile. the last
+// workgroup to finish (atomic counter) builds the remaining levels from
+// level 5 alone and resets the counter for the next dispatch.
+// odd sizes repeat the edge texels.
+//
+
+//vkcontext_t::MipMax
+#define MIP_MAX 13
+
+layout(set=0, binding=0, rgba8) uniform coherent image2D mips[MIP_MAX];
+
+layout(std430, set=0, binding=1) coherent buffer counter_t {
+	uint counter;
+};
+
+layout(push_constant) uniform push_t {
+	uint width;
+	uint height;
+	uint levels;
+	uint group_count;
+} push;
+
+layout(local_size_x=16, local_size_y=16, local_size_z=1) in;
+
+shared vec4 sh_texel[16][16];
+shared bool sh_is_last;
+
+ivec2 level_size(uint level) {
+	return ivec2(max(uvec2(push.width, push.height) >> level, uvec2(1)));
+}
+
+//2x2 box of the level above.
+vec4 load_average(uint level, ivec2 dst) {
+	ivec2 limit = level_size(level - 1) - 1;
+	ivec2 src = dst * 2;
+	vec4 ret = imageLoad(mips[level - 1], min(src, limit));
+	ret += imageLoad(mips[level - 1], min(src + ivec2(1, 0), limit));
+	ret += imageLoad(mips[level - 1], min(src + ivec2(0, 1), limit));
+	ret += imageLoad(mips[level - 1], min(src + ivec2(1, 1), limit));
+	return ret * 0.25;
+}
+
+void main()
+{
+	uvec2 lid = gl_LocalInvocationID.xy;
+	ivec2 dst = ivec2(gl_GlobalInvocationID.xy);
+
+	//level 1 from level 0, one texel per thread.
+	vec4 value = load_average(1, dst);
+	if(all(lessThan(dst, level_size(1))))
+		imageStore(mips[1], dst, value);
+	sh_texel[lid.y][lid.x] = value;
+	barrier();
+
+	//levels 2..5 of the tile stay in shared memory.
+	uint n = 8;
+	for(uint level = 2; level < min(push.levels, 6u); level++, n >>= 1) {
+		bool is_active = all(lessThan(lid, uvec2(n)));
+		if(is_active) {
+			uvec2 src = lid * 2;
+			value = sh_texel[src.y][src.x] + sh_texel[src.y][src.x + 1];
+			value += sh_texel[src.y + 1][src.x] + sh_texel[src.y + 1][src.x + 1];
+			value *= 0.25;
+		}
+		barrier();
+		if(is_active) {
+			sh_texel[lid.y][lid.x] = value;
+			ivec2 pos = ivec2(gl_WorkGroupID.xy * n + lid);
+			if(all(lessThan(pos, level_size(level))))
+				imageStore(mips[level], pos, value);
+		}
+		barrier();
+	}
+	if(push.levels <= 6)
+		return;
+
+	//the last workgroup sees every level 5 texel.
+	memoryBarrierImage();
+	barrier();
+	if(lid == uvec2(0))
+		sh_is_last = atomicAdd(counter, 1u) == push.group_count - 1;
+	barrier();
+	if(!sh_is_last)
+		return;
+	memoryBarrierImage();
+
+	for(uint level = 6; level < push.levels; level++) {
+		ivec2 size = level_size(level);
+		for(int y = int(lid.y); y < size.y; y += 16)
+			for(int x = int(lid.x); x < size.x; x += 16)
+				imageStore(mips[level], ivec2(x, y), load_average(level, ivec2(x, y)));
+		memoryBarrierImage();
+		barrier();
+	}
+	if(lid == uvec2(0))
+		counter = 0;
+}
@@ -27,6 +27,7 @@ layout(set=0, binding=1) uniform sampler2D prev_tex[];
 layout(set=0, binding=2) uniform sampler2D tex_user[];
 
 #ifdef _VS_
+//packed vertex formats fill the missing components with (0, 0, 0, 1).
 layout(location=0) in vec4 position;
 layout(location=1) in vec4 uv;
 layout(location=2) in vec4 color;
@@ -54,12 +55,14 @@ layout(location=2) in vec4 v_color;
 
 layout(location=0) out vec4 out_color;
 
+//index of this layer, every layer below it is added.
+layout(constant_id=0) const uint LayerIndex = 3;
+
 void main(){
 	vec2 uv = v_uv;
 	out_color.xyz = vec3(0.0);
-	out_color.xyz += texture(tex[0], uv).xyz;
-	out_color.xyz += texture(tex[1], uv).xyz;
-	out_color.xyz += texture(tex[2], uv).xyz;
+	for (uint i = 0; i < LayerIndex; i++)
+		out_color.xyz += texture(tex[i], uv).xyz;
 	out_color.a = 1.0;
 }
 #endif //_PS_
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2020 gyabo <gyaboyan@gmail.com>
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+#version 450 core
+#extension GL_EXT_nonuniform_qualifier : enable
+
+//
+// radix sort of the layer objects, 4 bits per pass, 8 passes.
+// key : (0xFFFF - depth) << 16 | matid, so far objects come first and
+// equal depths are grouped by material. invalid and culled objects get
+// 0xFFFFFFFF and end up last. the sorted object indices are read by
+// update_buffer.glsl.
+//
+// SortPass 0 : build keys and indices into keys[0], vals[0]
+// SortPass 1 : per workgroup digit count into hist[digit * groups + group]
+// SortPass 2 : exclusive scan of hist (one workgroup)
+// SortPass 3 : stable scatter into the other keys/vals
+//
+
+struct object_data {
+	vec4 pos;
+	vec4 scale;
+	vec4 rotate;
+	vec4 color;
+	vec4 uvinfo;
+	uint metadata[4];
+};
+
+//vkcontext_t::layer_args_t
+struct layer_args {
+	uint vertex_count;
+	uint instance_count;
+	uint first_vertex;
+	uint first_instance;
+	uint dispatch[3];
+	uint object_count;
+};
+
+layout(std430, set=2, binding=0) readonly buffer obj_t {
+	object_data obj[];
+};
+
+layout(std430, set=2, binding=2) readonly buffer args_t {
+	layer_args args[];
+};
+
+//keys[2][ObjectMax], vals[2][ObjectMax], hist[]
+layout(std430, set=2, binding=4) buffer sort_t {
+	uint sort_words[];
+};
+
+//vkcontext_t::push_constant_t
+layout(push_constant) uniform push_t {
+	uint layer_index;
+	uint flags;
+	uint shift;
+	uint reserved;
+} push;
+
+layout(constant_id=1) const uint SortPass = 0;
+layout(local_size_x_id=0, local_size_y=1, local_size_z=1) in;
+
+shared uint sh_hist[16];
+shared uvec4 sh_lo[gl_WorkGroupSize.x];
+shared uvec4 sh_hi[gl_WorkGroupSize.x];
+
+uint keys_offset(uint n) { return n * obj.length(); }
+uint vals_offset(uint n) { return (2 + n) * obj.length(); }
+uint hist_offset() { return 4 * obj.length(); }
+
+//pass = shift / 4, the pass reads buffer (pass & 1).
+uint src_buffer() { return (push.shift / 4) & 1; }
+
+uint make_key(uint tid) {
+	vec2 pos = obj[tid].pos.xy;
+	float radius = length(obj[tid].scale.xy);
+	bool is_visible = all(lessThanEqual(abs(pos) - radius, vec2(1.0)));
+	if(obj[tid].metadata[0] == 0 || !is_visible)
+		return 0xFFFFFFFF;
+	uint depth = uint(clamp(obj[tid].pos.z, 0.0, 1.0) * 65535.0 + 0.5);
+	return ((0xFFFF - depth) << 16) | (obj[tid].metadata[1] & 0xFFFF);
+}
+
+void main()
+{
+	uint lid = gl_LocalInvocationID.x;
+	uint tid = gl_GlobalInvocationID.x;
+	uint count = min(args[push.layer_index].object_count, obj.length());
+	uint groups = (count + gl_WorkGroupSize.x - 1) / gl_WorkGroupSize.x;
+
+	if(SortPass == 0) {
+		if(tid < count) {
+			sort_words[keys_offset(0) + tid] = make_key(tid);
+			sort_words[vals_offset(0) + tid] = tid;
+		}
+	}
+
+	if(SortPass == 1) {
+		if(lid < 16)
+			sh_hist[lid] = 0;
+		barrier();
+		if(tid < count) {
+			uint digit = (sort_words[keys_offset(src_buffer()) + tid] >> push.shift) & 0xF;
+			atomicAdd(sh_hist[digit], 1);
+		}
+		barrier();
+		if(lid < 16)
+			sort_words[hist_offset() + lid * groups + gl_WorkGroupID.x] = sh_hist[lid];
+	}
+
+	if(SortPass == 2) {
+		//each thread scans a contiguous run, then the run totals are scanned.
+		uint n = 16 * groups;
+		uint run = (n + gl_WorkGroupSize.x - 1) / gl_WorkGroupSize.x;
+		uint first = min(lid * run, n);
+		uint last = min(first + run, n);
+		uint sum = 0;
+		for(uint i = first; i < last; i++)
+			sum += sort_words[hist_offset() + i];
+		sh_lo[lid].x = sum;
+		barrier();
+		for(uint d = 1; d < gl_WorkGroupSize.x; d <<= 1) {
+			uint v = lid >= d ? sh_lo[lid - d].x : 0;
+			barrier();
+			sh_lo[lid].x += v;
+			barrier();
+		}
+		uint base = sh_lo[lid].x - sum;
+		for(uint i = first; i < last; i++) {
+			uint v = sort_words[hist_offset() + i];
+			sort_words[hist_offset() + i] = base;
+			base += v;
+		}
+	}
+
+	if(SortPass == 3) {
+		//16 digit counters packed as 16 bit halves, one scan ranks all digits.
+		uint key = 0;
+		uint val = 0;
+		uint digit = 0;
+		uvec4 lo = uvec4(0);
+		uvec4 hi = uvec4(0);
+		if(tid < count) {
+			key = sort_words[keys_offset(src_buffer()) + tid];
+			val = sort_words[vals_offset(src_buffer()) + tid];
+			digit = (key >> push.shift) & 0xF;
+			uint bit = 1 << ((digit & 1) * 16);
+			if(digit < 8)
+				lo[digit >> 1] = bit;
+			else
+				hi[(digit - 8) >> 1] = bit;
+		}
+		sh_lo[lid] = lo;
+		sh_hi[lid] = hi;
+		barrier();
+		for(uint d = 1; d < gl_WorkGroupSize.x; d <<= 1) {
+			uvec4 vlo = lid >= d ? sh_lo[lid - d] : uvec4(0);
+			uvec4 vhi = lid >= d ? sh_hi[lid - d] : uvec4(0);
+			barrier();
+			sh_lo[lid] += vlo;
+			sh_hi[lid] += vhi;
+			barrier();
+		}
+		if(tid < count) {
+			uvec4 ranks = digit < 8 ? sh_lo[lid] - lo : sh_hi[lid] - hi;
+			uint rank = (ranks[(digit & 7) >> 1] >> ((digit & 1) * 16)) & 0xFFFF;
+			uint dst = sort_words[hist_offset() + digit * groups + gl_WorkGroupID.x] + rank;
+			uint dst_buffer = src_buffer() ^ 1;
+			sort_words[keys_offset(dst_buffer) + dst] = key;
+			sort_words[vals_offset(dst_buffer) + dst] = val;
+		}
+	}
+}
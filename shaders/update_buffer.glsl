@@ -31,22 +31,94 @@ struct object_data {
 	uint metadata[4];
 };
 
-struct vertex_format {
-	vec4 pos;
-	vec4 uv;
-	vec4 color;
-	uint matid;
-	uint reserved[3];
-};
-
 layout(std430, set=2, binding=0) buffer obj_t {
 	object_data obj[];
 };
 
+//vkcontext_t::VERTEX_FORMAT_*, raw words so every layout shares one binding.
+layout(constant_id=1) const uint VertexFormat = 0;
+
 layout(std430, set=2, binding=1) buffer vtx_t {
-	vertex_format vtx[];
+	uint vtx_words[];
+};
+
+void write_vertex(uint index, vec2 pos, vec2 uv, vec4 color, uint matid)
+{
+	if(VertexFormat == 0) {
+		//vec4 pos, vec4 uv, vec4 color, uint matid, uint reserved[3]
+		uint base = index * 16;
+		vtx_words[base + 0] = floatBitsToUint(pos.x);
+		vtx_words[base + 1] = floatBitsToUint(pos.y);
+		vtx_words[base + 2] = floatBitsToUint(0.0);
+		vtx_words[base + 3] = floatBitsToUint(1.0);
+		vtx_words[base + 4] = floatBitsToUint(uv.x);
+		vtx_words[base + 5] = floatBitsToUint(uv.y);
+		vtx_words[base + 6] = floatBitsToUint(0.0);
+		vtx_words[base + 7] = floatBitsToUint(1.0);
+		vtx_words[base + 8] = floatBitsToUint(color.x);
+		vtx_words[base + 9] = floatBitsToUint(color.y);
+		vtx_words[base + 10] = floatBitsToUint(color.z);
+		vtx_words[base + 11] = floatBitsToUint(color.w);
+		vtx_words[base + 12] = matid;
+	} else if(VertexFormat == 1) {
+		//float pos[2], unorm16 uv[2], unorm8 color[4], uint16 matid
+		uint base = index * 5;
+		vtx_words[base + 0] = floatBitsToUint(pos.x);
+		vtx_words[base + 1] = floatBitsToUint(pos.y);
+		vtx_words[base + 2] = packUnorm2x16(uv);
+		vtx_words[base + 3] = packUnorm4x8(color);
+		vtx_words[base + 4] = matid & 0xFFFF;
+	} else {
+		//half pos[2], unorm16 uv[2], unorm8 color[4], uint16 matid
+		uint base = index * 4;
+		vtx_words[base + 0] = packHalf2x16(pos);
+		vtx_words[base + 1] = packUnorm2x16(uv);
+		vtx_words[base + 2] = packUnorm4x8(color);
+		vtx_words[base + 3] = matid & 0xFFFF;
+	}
+}
+
+//vkcontext_t::layer_args_t
+struct layer_args {
+	uint vertex_count;
+	uint instance_count;
+	uint first_vertex;
+	uint first_instance;
+	uint dispatch[3];
+	uint object_count;
+};
+
+layout(std430, set=2, binding=2) buffer args_t {
+	layer_args args[];
+};
+
+//cleared before each dispatch.
+//prefix[n] : inclusive valid count up to workgroup n + 1, 0 is not ready.
+layout(std430, set=2, binding=3) coherent buffer scan_t {
+	uint ticket;
+	uint prefix[];
 };
 
+//sort_objects.glsl output, vals[0] holds the sorted object indices.
+layout(std430, set=2, binding=4) readonly buffer sort_t {
+	uint sort_words[];
+};
+
+//vkcontext_t::push_constant_t, flags bit 0 : the layer is sorted.
+layout(push_constant) uniform push_t {
+	uint layer_index;
+	uint flags;
+	uint shift;
+	uint reserved;
+} push;
+
+//bounding circle of the rotated quad against clip space.
+bool is_visible(uint tid) {
+	vec2 pos = obj[tid].pos.xy;
+	float radius = length(obj[tid].scale.xy);
+	return all(lessThanEqual(abs(pos) - radius, vec2(1.0)));
+}
+
 vec2 rotate(vec2 p, float a) {
 	float c = cos(a);
 	float s = sin(a);
@@ -55,14 +127,62 @@ vec2 rotate(vec2 p, float a) {
 		p.x * s + p.y * c);
 }
 
-layout(local_size_x=1, local_size_y=1, local_size_z=1) in;
+//WorkgroupSize (64, 128 or 256) is given by constant_id 0.
+layout(local_size_x_id=0, local_size_y=1, local_size_z=1) in;
+
+shared uint sh_scan[gl_WorkGroupSize.x];
+shared uint sh_group;
+shared uint sh_base;
+
 void main()
 {
-	uint tid = gl_GlobalInvocationID.x;
-	uint valid = obj[tid].metadata[0];
+	//workgroups take tickets in launch order, so the previous one is always running or done.
+	uint lid = gl_LocalInvocationID.x;
+	if(lid == 0)
+		sh_group = atomicAdd(ticket, 1);
+	barrier();
+
+	uint group = sh_group;
+	uint index = group * gl_WorkGroupSize.x + lid;
+	uint tid = index;
+	uint valid = 0;
+	if(index < args[push.layer_index].object_count && index < obj.length()) {
+		if((push.flags & 1) != 0)
+			tid = sort_words[2 * obj.length() + index];
+		valid = (obj[tid].metadata[0] != 0 && is_visible(tid)) ? 1 : 0;
+	}
+
+	//inclusive prefix sum of the valid and visible flags.
+	sh_scan[lid] = valid;
+	barrier();
+	for(uint d = 1; d < gl_WorkGroupSize.x; d <<= 1) {
+		uint v = lid >= d ? sh_scan[lid - d] : 0;
+		barrier();
+		sh_scan[lid] += v;
+		barrier();
+	}
+
+	//chain the workgroup totals, the last one writes the draw count.
+	if(lid == 0) {
+		uint base = 0;
+		if(group > 0) {
+			do {
+				base = atomicAdd(prefix[group - 1], 0);
+			} while(base == 0);
+			base -= 1;
+		}
+		uint total = base + sh_scan[gl_WorkGroupSize.x - 1];
+		atomicExchange(prefix[group], total + 1);
+		if(group == gl_NumWorkGroups.x - 1)
+			args[push.layer_index].vertex_count = total * 6;
+		sh_base = base;
+	}
+	barrier();
+
 	if(valid == 0)
 		return;
 
+	uint dst = sh_base + sh_scan[lid] - 1;
 	vec4 pos = obj[tid].pos;
 	vec4 scale = obj[tid].scale;
 	vec4 color = obj[tid].color;
@@ -100,36 +220,12 @@ void main()
 	basepos[2] += pos.xy;
 	basepos[3] += pos.xy;
 
-	//result
+	//result : triangle list 0 1 2, 1 3 2
 	vec2 aspect = vec2(1.0, 1.0);
-	vtx[tid * 6 + 0].pos = vec4(basepos[0] * aspect, 0, 1);
-	vtx[tid * 6 + 1].pos = vec4(basepos[1] * aspect, 0, 1);
-	vtx[tid * 6 + 2].pos = vec4(basepos[2] * aspect, 0, 1);
-	vtx[tid * 6 + 3].pos = vec4(basepos[1] * aspect, 0, 1);
-	vtx[tid * 6 + 4].pos = vec4(basepos[3] * aspect, 0, 1);
-	vtx[tid * 6 + 5].pos = vec4(basepos[2] * aspect, 0, 1);
-
-	//uv
-	vtx[tid * 6 + 0].uv = vec4(baseuv[0], 0, 1);
-	vtx[tid * 6 + 1].uv = vec4(baseuv[1], 0, 1);
-	vtx[tid * 6 + 2].uv = vec4(baseuv[2], 0, 1);
-	vtx[tid * 6 + 3].uv = vec4(baseuv[1], 0, 1);
-	vtx[tid * 6 + 4].uv = vec4(baseuv[3], 0, 1);
-	vtx[tid * 6 + 5].uv = vec4(baseuv[2], 0, 1);
-	
-	//color
-	vtx[tid * 6 + 0].color = color;
-	vtx[tid * 6 + 1].color = color;
-	vtx[tid * 6 + 2].color = color;
-	vtx[tid * 6 + 3].color = color;
-	vtx[tid * 6 + 4].color = color;
-	vtx[tid * 6 + 5].color = color;
-	
-	//matid
-	vtx[tid * 6 + 0].matid = matid;
-	vtx[tid * 6 + 1].matid = matid;
-	vtx[tid * 6 + 2].matid = matid;
-	vtx[tid * 6 + 3].matid = matid;
-	vtx[tid * 6 + 4].matid = matid;
-	vtx[tid * 6 + 5].matid = matid;
+	write_vertex(dst * 6 + 0, basepos[0] * aspect, baseuv[0], color, matid);
+	write_vertex(dst * 6 + 1, basepos[1] * aspect, baseuv[1], color, matid);
+	write_vertex(dst * 6 + 2, basepos[2] * aspect, baseuv[2], color, matid);
+	write_vertex(dst * 6 + 3, basepos[1] * aspect, baseuv[1], color, matid);
+	write_vertex(dst * 6 + 4, basepos[3] * aspect, baseuv[3], color, matid);
+	write_vertex(dst * 6 + 5, basepos[2] * aspect, baseuv[2], color, matid);
 }
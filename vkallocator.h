@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2020 gyabo <gyaboyan@gmail.com>
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+#pragma once
+
+#include "vkwin32.h"
+
+//
+// device memory sub-allocator.
+// each memory type has two pools, linear (buffers) and optimal (images), so
+// bufferImageGranularity never matters. a pool is a list of power of two
+// blocks split as buddies, so every allocation is aligned to its own size.
+// allocations larger than a block get a dedicated VkDeviceMemory.
+// host visible blocks are mapped once and stay mapped.
+//
+struct vkallocator_t {
+	enum {
+		MinOrder = 8,
+	};
+
+	struct allocation_t {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		uint8_t *mapped = nullptr;
+		uint32_t pool_index = 0;
+		uint32_t block_index = 0;
+		uint32_t order = 0;
+	};
+
+	struct block_t {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		uint8_t *mapped = nullptr;
+		VkDeviceSize used = 0;
+		std::vector<std::vector<VkDeviceSize>> vfree_lists;
+	};
+
+	struct pool_t {
+		std::vector<block_t> blocks;
+	};
+
+	VkPhysicalDevice gpudev = VK_NULL_HANDLE;
+	VkDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties devprop = {};
+	VkDeviceSize block_size = 0;
+	uint32_t block_order = 0;
+	VkDeviceSize budget = 0;
+	VkDeviceSize device_local_usage = 0;
+	uint32_t allocation_count = 0;
+	std::vector<pool_t> vpools;
+
+	void init(VkPhysicalDevice gpudev_, VkDevice device_, VkDeviceSize block_size_, VkDeviceSize budget_)
+	{
+		gpudev = gpudev_;
+		device = device_;
+		vkGetPhysicalDeviceMemoryProperties(gpudev, &devprop);
+		block_order = MinOrder;
+		while ((VkDeviceSize(1) << block_order) < block_size_)
+			block_order++;
+		block_size = VkDeviceSize(1) << block_order;
+		budget = budget_;
+		vpools.resize(devprop.memoryTypeCount * 2);
+	}
+
+	bool is_host_visible(uint32_t type_index)
+	{
+		return (devprop.memoryTypes[type_index].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+	}
+
+	bool is_device_local(uint32_t type_index)
+	{
+		return (devprop.memoryTypes[type_index].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0;
+	}
+
+	//budget only limits device local memory, 0 is unlimited.
+	VkDeviceMemory allocate_memory(uint32_t type_index, VkDeviceSize size, uint8_t **mapped)
+	{
+		VkDeviceMemory ret = VK_NULL_HANDLE;
+		if (is_device_local(type_index) && budget && device_local_usage + size > budget) {
+			printf("vkallocator_t : out of budget (%llu + %llu > %llu)\n",
+				(unsigned long long)device_local_usage, (unsigned long long)size, (unsigned long long)budget);
+			return (ret);
+		}
+
+		VkMemoryAllocateInfo ma_info = {};
+		ma_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		ma_info.allocationSize = size;
+		ma_info.memoryTypeIndex = type_index;
+		if (vkAllocateMemory(device, &ma_info, nullptr, &ret) != VK_SUCCESS) {
+			printf("vkallocator_t : vkAllocateMemory failed (%llu bytes)\n", (unsigned long long)size);
+			return VK_NULL_HANDLE;
+		}
+		allocation_count++;
+		if (is_device_local(type_index))
+			device_local_usage += size;
+		*mapped = nullptr;
+		if (is_host_visible(type_index))
+			vkMapMemory(device, ret, 0, size, 0, (void **)mapped);
+
+		return (ret);
+	}
+
+	void free_memory(uint32_t type_index, VkDeviceMemory memory, VkDeviceSize size)
+	{
+		vkFreeMemory(device, memory, nullptr);
+		allocation_count--;
+		if (is_device_local(type_index))
+			device_local_usage -= size;
+	}
+
+	//take a free range of 2^order from block, splitting larger ones.
+	bool take_from_block(block_t & block, uint32_t order, VkDeviceSize & offset)
+	{
+		uint32_t found = order;
+		while (found <= block_order && block.vfree_lists[found - MinOrder].empty())
+			found++;
+		if (found > block_order)
+			return false;
+
+		auto & vfree = block.vfree_lists[found - MinOrder];
+		offset = vfree.back();
+		vfree.pop_back();
+		while (found > order) {
+			found--;
+			block.vfree_lists[found - MinOrder].push_back(offset + (VkDeviceSize(1) << found));
+		}
+		block.used += VkDeviceSize(1) << order;
+
+		return true;
+	}
+
+	allocation_t alloc(const VkMemoryRequirements & memreqs, VkMemoryPropertyFlags flags, bool is_linear)
+	{
+		allocation_t ret = {};
+		uint32_t type_index = find_memory_type_index(devprop, memreqs.memoryTypeBits, flags);
+		if (type_index == UINT32_MAX) {
+			printf("vkallocator_t : no memory type for bits=0x%08X flags=0x%08X\n", memreqs.memoryTypeBits, flags);
+			return (ret);
+		}
+
+		uint32_t order = MinOrder;
+		VkDeviceSize size = std::max(memreqs.size, memreqs.alignment);
+		while ((VkDeviceSize(1) << order) < size)
+			order++;
+
+		ret.pool_index = type_index * 2 + (is_linear ? 1 : 0);
+		ret.size = memreqs.size;
+
+		//dedicated
+		if (order > block_order) {
+			ret.memory = allocate_memory(type_index, memreqs.size, &ret.mapped);
+			ret.order = 0;
+			return (ret);
+		}
+
+		auto & pool = vpools[ret.pool_index];
+		ret.order = order;
+		for (uint32_t i = 0 ; i < pool.blocks.size(); i++) {
+			auto & block = pool.blocks[i];
+			if (block.memory == VK_NULL_HANDLE || !take_from_block(block, order, ret.offset))
+				continue;
+			ret.memory = block.memory;
+			ret.block_index = i;
+			ret.mapped = block.mapped ? block.mapped + ret.offset : nullptr;
+			return (ret);
+		}
+
+		//new block, in a released slot if there is one.
+		uint32_t block_index = 0;
+		while (block_index < pool.blocks.size() && pool.blocks[block_index].memory)
+			block_index++;
+		if (block_index == pool.blocks.size())
+			pool.blocks.push_back({});
+		auto & block = pool.blocks[block_index];
+		block.memory = allocate_memory(type_index, block_size, &block.mapped);
+		if (block.memory == VK_NULL_HANDLE) {
+			ret.order = 0;
+			return (ret);
+		}
+		block.vfree_lists.resize(block_order - MinOrder + 1);
+		block.vfree_lists[block_order - MinOrder].push_back(0);
+		take_from_block(block, order, ret.offset);
+		ret.memory = block.memory;
+		ret.block_index = block_index;
+		ret.mapped = block.mapped ? block.mapped + ret.offset : nullptr;
+
+		return (ret);
+	}
+
+	void free(allocation_t & allocation)
+	{
+		if (allocation.memory == VK_NULL_HANDLE)
+			return;
+		uint32_t type_index = allocation.pool_index / 2;
+		if (allocation.order == 0) {
+			free_memory(type_index, allocation.memory, allocation.size);
+			allocation = {};
+			return;
+		}
+
+		//merge with the buddy while it is free.
+		auto & block = vpools[allocation.pool_index].blocks[allocation.block_index];
+		VkDeviceSize offset = allocation.offset;
+		uint32_t order = allocation.order;
+		block.used -= VkDeviceSize(1) << order;
+		while (order < block_order) {
+			auto & vfree = block.vfree_lists[order - MinOrder];
+			VkDeviceSize buddy = offset ^ (VkDeviceSize(1) << order);
+			auto it = std::find(vfree.begin(), vfree.end(), buddy);
+			if (it == vfree.end())
+				break;
+			vfree.erase(it);
+			offset = std::min(offset, buddy);
+			order++;
+		}
+		block.vfree_lists[order - MinOrder].push_back(offset);
+
+		//keep one empty block per pool for reuse, release the others.
+		if (block.used == 0) {
+			uint32_t empty_count = 0;
+			for (auto & b : vpools[allocation.pool_index].blocks)
+				if (b.memory && b.used == 0)
+					empty_count++;
+			if (empty_count > 1) {
+				free_memory(type_index, block.memory, block_size);
+				block = {};
+			}
+		}
+		allocation = {};
+	}
+
+	allocation_t bind_buffer(VkBuffer buffer, VkMemoryPropertyFlags flags)
+	{
+		VkMemoryRequirements memreqs = {};
+		vkGetBufferMemoryRequirements(device, buffer, &memreqs);
+		auto ret = alloc(memreqs, flags, true);
+		if (ret.memory)
+			vkBindBufferMemory(device, buffer, ret.memory, ret.offset);
+
+		return (ret);
+	}
+
+	allocation_t bind_image(VkImage image, VkMemoryPropertyFlags flags)
+	{
+		VkMemoryRequirements memreqs = {};
+		vkGetImageMemoryRequirements(device, image, &memreqs);
+		auto ret = alloc(memreqs, flags, false);
+		if (ret.memory)
+			vkBindImageMemory(device, image, ret.memory, ret.offset);
+
+		return (ret);
+	}
+};
@@ -21,7 +21,15 @@
  */
 #pragma once
 
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <future>
 #include "vkwin32.h"
+#include "vkallocator.h"
+#include "cpuexpand.h"
+#include "bccodec.h"
+#include "assetpack.h"
 
 struct vkcontext_t {
 	struct vertex_format {
@@ -32,6 +40,24 @@ struct vkcontext_t {
 		uint32_t reserved[3];
 	};
 
+	//VERTEX_FORMAT_PACKED_FLOAT, 20 bytes.
+	struct vertex_packed_float_format {
+		float pos[2];
+		uint16_t uv[2];
+		uint8_t color[4];
+		uint16_t matid;
+		uint16_t reserved;
+	};
+
+	//VERTEX_FORMAT_PACKED_HALF, 16 bytes.
+	struct vertex_packed_half_format {
+		uint16_t pos[2];
+		uint16_t uv[2];
+		uint8_t color[4];
+		uint16_t matid;
+		uint16_t reserved;
+	};
+
 	struct object_format {
 		float pos[4];
 		float scale[4];
@@ -41,13 +67,73 @@ struct vkcontext_t {
 		uint32_t metadata[4];
 	};
 
+	//per layer indirect arguments, written by the host next to each other.
+	struct layer_args_t {
+		VkDrawIndirectCommand draw;
+		VkDispatchIndirectCommand dispatch;
+		uint32_t object_count;
+	};
+
+	enum {
+		DRAW_MODE_EXPAND,
+		DRAW_MODE_PULL,
+		DRAW_MODE_INSTANCED,
+	};
+
+	//layout of the expanded vertices, uv is clamped to [0, 1] by the packed ones.
+	enum {
+		VERTEX_FORMAT_FLOAT,
+		VERTEX_FORMAT_PACKED_FLOAT,
+		VERTEX_FORMAT_PACKED_HALF,
+	};
+
+	//what cmdbuf does with a layer, see record_layers.
+	enum {
+		LAYER_ACTION_DRAW,
+		LAYER_ACTION_CLEAR,
+		LAYER_ACTION_SKIP,
+	};
+
+	//create_info::PresentMode, unsupported ones fall back to FIFO.
+	enum {
+		PRESENT_MODE_FIFO,
+		PRESENT_MODE_MAILBOX,
+		PRESENT_MODE_IMMEDIATE,
+	};
+
+	//shared by every pipeline, see update_buffer.glsl and sort_objects.glsl.
+	enum {
+		PUSH_FLAG_SORTED = 1,
+	};
+
+	struct push_constant_t {
+		uint32_t layer_index;
+		uint32_t flags;
+		uint32_t shift;
+		uint32_t reserved;
+	};
+
+	//composite.glsl : tex[first_layer, first_layer + layer_count) are summed into the output.
+	struct composite_push_t {
+		uint32_t first_layer;
+		uint32_t layer_count;
+		uint32_t reserved[2];
+	};
+
 	struct create_info {
 		const char *appname;
 		HWND hwnd;
 		HINSTANCE hinst;
+		bool Headless;
+		bool CpuExpand;
+		uint32_t DrawMode;
+		uint32_t VertexFormat;
 		uint32_t ScreenW;
 		uint32_t ScreenH;
 		uint32_t FrameFifoMax;
+		uint32_t FramesInFlight;
+		uint32_t FrameLatency;
+		uint32_t PresentMode;
 		uint32_t Width;
 		uint32_t Height;
 		uint32_t BitsSize;
@@ -57,36 +143,86 @@ struct vkcontext_t {
 		uint32_t DescriptorArrayMax;
 		uint32_t DescriptorPoolMax;
 		uint64_t GpuMemoryMax;
+		uint64_t MemoryBlockSize;
 		uint64_t ObjectMaxBytes;
 		uint64_t VertexMaxBytes;
+		uint64_t ScanMaxBytes;
+		uint64_t SortMaxBytes;
+		uint64_t StagingRingBytes;
+		uint64_t UserImageBudget;
 		uint32_t DrawIndirectCommandSize;
+		uint32_t WorkgroupSize;
+		bool UserImageMips;
+		bool AsyncTransfer;
+		bool DynamicCommands;
+		bool SinglePass;
+		bool ComputeComposite;
 		std::vector<uint8_t> cs_update;
+		std::vector<uint8_t> vs_pull;
+		std::vector<uint8_t> cs_sort;
+		std::vector<uint8_t> cs_mip;
+		std::vector<uint8_t> cs_composite;
 		struct shader_layer_t {
 			std::vector<uint8_t> vs;
 			std::vector<uint8_t> ps;
+			bool is_sorted = false;
+
+			//SinglePass : the layer keeps its own image (for post effects) instead of being composited.
+			bool is_offscreen = false;
 		};
 		std::vector<shader_layer_t> shader_layers;
 	};
 	create_info info = {};
 
+	//[first, last) in objects.
+	struct dirty_range_t {
+		uint32_t first;
+		uint32_t last;
+	};
+
+	//per swapchain image (headless : per offscreen target), indexed by present_index.
+	struct swapchain_image_t {
+		VkImage image = VK_NULL_HANDLE;
+		vkallocator_t::allocation_t alloc_image;
+		VkSemaphore render_sem = VK_NULL_HANDLE;
+
+		//the fence of the last frame that drew into image.
+		VkFence fence = VK_NULL_HANDLE;
+
+		//ComputeComposite : out_image of composite.glsl.
+		VkImageView storage_view = VK_NULL_HANDLE;
+		VkDescriptorSet composite_descriptor_set = VK_NULL_HANDLE;
+	};
+
 	struct frame_info_t {
-		VkImage backbuffer_image = VK_NULL_HANDLE;
 		VkCommandBuffer cmdbuf = VK_NULL_HANDLE;
+
+		//the final blit (or composite dispatch) of this frame into each swapchain image.
+		std::vector<VkCommandBuffer> vpresent_cmdbufs;
+
+		//the LAYER_ACTION_* cmdbuf was recorded with.
+		std::vector<uint8_t> vlayer_actions;
 		VkSemaphore sem = VK_NULL_HANDLE;
 		VkFence fence = VK_NULL_HANDLE;
 
-		VkDescriptorSet descriptor_set_cbv = VK_NULL_HANDLE;
-		VkDescriptorSet descriptor_set_srv = VK_NULL_HANDLE;
+		//uploads of this frame, submitted before cmdbuf.
+		VkCommandBuffer upload_cmdbuf = VK_NULL_HANDLE;
+		bool is_upload_recording = false;
 
-		VkDeviceMemory devmem_host = VK_NULL_HANDLE;
-		VkDeviceMemory devmem_local_vertex = VK_NULL_HANDLE;
+		//copies on the transfer queue, cmdbuf waits transfer_sem at transfer_wait_stages.
+		VkCommandBuffer transfer_cmdbuf = VK_NULL_HANDLE;
+		VkSemaphore transfer_sem = VK_NULL_HANDLE;
+		VkPipelineStageFlags transfer_wait_stages = 0;
+		uint64_t staging_end = 0;
+		std::vector<uint32_t> dirty_user_images;
+		VkDescriptorPool mip_descriptor_pool = VK_NULL_HANDLE;
 
-		uint64_t devmem_host_offset = 0;
-		uint64_t devmem_local_vertex_offset = 0;
+		VkDescriptorSet descriptor_set_cbv = VK_NULL_HANDLE;
+		VkDescriptorSet descriptor_set_srv = VK_NULL_HANDLE;
 
 		VkBuffer indirect_draw_cmd_buffer = VK_NULL_HANDLE;
-		VkDrawIndirectCommand *host_draw_indirect_cmd = nullptr;
-		VkDeviceMemory devmem_host_draw_indirect_cmd = VK_NULL_HANDLE;
+		layer_args_t *host_layer_args = nullptr;
+		vkallocator_t::allocation_t alloc_indirect_draw_cmd;
 
 		struct layer_t {
 			VkDescriptorSet descriptor_set_uav = VK_NULL_HANDLE;
@@ -96,62 +232,730 @@ struct vkcontext_t {
 			VkBuffer buffer = VK_NULL_HANDLE;
 			void *host_memory_addr = nullptr;
 			VkBuffer vertex_buffer = VK_NULL_HANDLE;
+			VkBuffer scan_buffer = VK_NULL_HANDLE;
+			VkBuffer sort_buffer = VK_NULL_HANDLE;
+			void *host_vertex_addr = nullptr;
+			vkallocator_t::allocation_t alloc_image;
+			vkallocator_t::allocation_t alloc_buffer;
+			vkallocator_t::allocation_t alloc_vertex;
+			vkallocator_t::allocation_t alloc_scan;
+			vkallocator_t::allocation_t alloc_sort;
+
+			//object ranges of the retained layer not yet copied into buffer.
+			std::vector<dirty_range_t> dirty_ranges;
+
+			//what image holds : layer_state_t::version drawn with object_count objects, or nothing.
+			uint64_t drawn_version = UINT64_MAX;
+			uint32_t drawn_count = 0;
+			bool is_clear = false;
 		};
 		std::vector<layer_t> layers;
 	};
 
+	//the shared cursor of a layer, one cache line each.
+	struct sprite_layer_t {
+		alignas(64) std::atomic<uint32_t> cursor {0};
+		std::atomic<bool> is_used {false};
+	};
+
+	//one per thread and layer, the objects are reserved SpriteChunk at a time.
+	//the writers of a frame must be destroyed (or finished) before submit().
+	struct sprite_writer_t {
+		vkcontext_t *ctx = nullptr;
+		object_format *base = nullptr;
+		uint32_t layer_index = 0;
+		uint32_t next = 0;
+		uint32_t end = 0;
+		uint32_t cursor_end = 0;
+		uint32_t remain = UINT32_MAX;
+
+		//count : the most objects this writer will push, no reservation goes beyond it.
+		sprite_writer_t(vkcontext_t & context, uint32_t layer, uint32_t count = UINT32_MAX)
+		{
+			ctx = &context;
+			layer_index = layer;
+			remain = count;
+			base = ctx->get_object_format_address(layer);
+		}
+
+		~sprite_writer_t()
+		{
+			finish();
+		}
+
+		//nullptr once the layer is full.
+		object_format *push()
+		{
+			if (next == end) {
+				uint32_t count = std::min<uint32_t>(SpriteChunk, remain);
+				if (count == 0)
+					return nullptr;
+				next = ctx->reserve_sprites(layer_index, count, end, cursor_end);
+				if (next == end)
+					return nullptr;
+				remain -= end - next;
+			}
+			return (base + next++);
+		}
+
+		//the unused rest of the chunk goes back to the layer when no other writer reserved after it,
+		//else it is left as invalid objects.
+		void finish()
+		{
+			if (next < end && ctx->release_sprites(layer_index, next, cursor_end))
+				end = next;
+			for ( ; next < end; next++)
+				base[next].metadata[0] = 0;
+		}
+	};
+
+	//DynamicCommands : a static layer is drawn again only after invalidate_layer.
+	struct layer_state_t {
+		bool is_static = false;
+		uint64_t version = 0;
+	};
+
+	//the authoritative objects of a layer, copied into each frame by dirty ranges.
+	struct retained_layer_t {
+		std::vector<object_format> objects;
+		uint32_t object_count = 0;
+	};
+
 	struct user_image_t {
-		bool is_submitted = false;
 		VkImageCreateInfo info;
 		VkImage image = VK_NULL_HANDLE;
 		VkImageView image_view = VK_NULL_HANDLE;
-		VkDeviceMemory devmem_image = VK_NULL_HANDLE;
+		vkallocator_t::allocation_t alloc_image;
 
-		VkBuffer buffer = VK_NULL_HANDLE;
-		VkDeviceMemory devmem_buffer = VK_NULL_HANDLE;
-		VkCommandBuffer transfer_cmdbuf = VK_NULL_HANDLE;
+		//residency : an image with a source is loaded when drawn and may be evicted.
+		uint32_t width = 0;
+		uint32_t height = 0;
+		uint64_t last_used_frame = 0;
+		uint64_t retire_frame = 0;
+		VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+		std::function<void(void *)> source;
+
+		//one storage view per level for mip_generate.glsl.
+		uint32_t mip_levels = 1;
+		std::vector<VkImageView> mip_views;
 	};
 
-	void upload_user_image(uint32_t slot, uint32_t width, uint32_t height, void *src)
+	//the source of a user image runs once on a worker thread, its texels (or BC blocks) stay here for reloads.
+	struct user_image_load_t {
+		std::future<std::vector<uint8_t>> task;
+		std::vector<uint8_t> data;
+		bool is_ready = false;
+	};
+
+	//BC_FORMAT_* of a block compressed format, UINT32_MAX otherwise.
+	static uint32_t get_bc_format(VkFormat format)
 	{
-		user_image_t uimg = {};
-		uimg.image = create_image(device, width, height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, &uimg.info);
-		VkDeviceSize size = get_image_memreq_size(device, uimg.image);
-		uimg.buffer = create_buffer(device, size);
-		uimg.devmem_image = alloc_device_memory(gpudev, device, size, false);
-		uimg.devmem_buffer = alloc_device_memory(gpudev, device, size, true);
-		vkBindImageMemory(device, uimg.image, uimg.devmem_image, 0);
-		vkBindBufferMemory(device, uimg.buffer, uimg.devmem_buffer, 0);
+		if (format == VK_FORMAT_BC1_RGBA_UNORM_BLOCK)
+			return BC_FORMAT_BC1;
+		if (format == VK_FORMAT_BC3_UNORM_BLOCK)
+			return BC_FORMAT_BC3;
+		if (format == VK_FORMAT_BC7_UNORM_BLOCK)
+			return BC_FORMAT_BC7;
+		return UINT32_MAX;
+	}
 
-		uimg.image_view = create_image_view(device, uimg.image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
-		for (int i = 0 ; i < info.FrameFifoMax; i++) {
-			auto & ref = vframe_infos[i];
-			update_descriptor_combined_image_sample(device, ref.descriptor_set_srv, 2, slot, uimg.image_view, sampler);
+	//the layer is retained from now on : its objects live here and get_object_format_address is not used.
+	object_format *get_retained_objects(uint32_t layer_index)
+	{
+		auto & rlayer = vretained_layers[layer_index];
+		if (rlayer.objects.empty()) {
+			rlayer.objects.resize(info.ObjectMax);
+			memset(rlayer.objects.data(), 0, sizeof(object_format) * info.ObjectMax);
+			mark_objects_dirty(layer_index, 0, info.ObjectMax);
+		}
+		return rlayer.objects.data();
+	}
+
+	//every frame copies the range once, before its next submit.
+	void mark_objects_dirty(uint32_t layer_index, uint32_t first, uint32_t count)
+	{
+		uint32_t last = std::min(first + count, info.ObjectMax);
+		if (first >= last)
+			return;
+		invalidate_layer(layer_index);
+		for (auto & frame : vframe_infos) {
+			auto & ranges = frame.layers[layer_index].dirty_ranges;
+
+			//neighbours merge, too many ranges fall back to their bounding range.
+			if (!ranges.empty() && first <= ranges.back().last && last >= ranges.back().first) {
+				ranges.back().first = std::min(ranges.back().first, first);
+				ranges.back().last = std::max(ranges.back().last, last);
+				continue;
+			}
+			if (ranges.size() >= DirtyRangeMax) {
+				dirty_range_t bound = {first, last};
+				for (auto & range : ranges) {
+					bound.first = std::min(bound.first, range.first);
+					bound.last = std::max(bound.last, range.last);
+				}
+				ranges.clear();
+				ranges.push_back(bound);
+				continue;
+			}
+			ranges.push_back({first, last});
+		}
+	}
+
+	void set_layer_static(uint32_t layer_index, bool is_static)
+	{
+		vlayer_states[layer_index].is_static = is_static;
+	}
+
+	//the objects of a static layer have changed, every frame draws it once more.
+	void invalidate_layer(uint32_t layer_index)
+	{
+		vlayer_states[layer_index].version++;
+	}
+
+	//empty layers are cleared once, unchanged static ones keep the image of the last time.
+	std::vector<uint8_t> get_layer_actions(frame_info_t & ref)
+	{
+		std::vector<uint8_t> ret(ref.layers.size(), LAYER_ACTION_DRAW);
+		for (uint32_t layer_num = 0 ; layer_num < ref.layers.size(); layer_num++) {
+			auto & layer = ref.layers[layer_num];
+			auto & state = vlayer_states[layer_num];
+			uint32_t count = ref.host_layer_args[layer_num].object_count;
+			//SinglePass clears and draws the target every time, so these skips save nothing and are not counted.
+			if (is_composited(layer_num)) {
+				ret[layer_num] = count && is_drawn_into_target(layer_num) ? LAYER_ACTION_DRAW : LAYER_ACTION_SKIP;
+				continue;
+			}
+
+			//ComputeComposite : record_layers never draws the present layer.
+			if (is_compute_composite && layer_num == info.LayerMax - 1)
+				continue;
+			if (count == 0) {
+				ret[layer_num] = layer.is_clear ? LAYER_ACTION_SKIP : LAYER_ACTION_CLEAR;
+				layer.is_clear = true;
+				layer.drawn_version = UINT64_MAX;
+			} else if (state.is_static && layer.drawn_version == state.version && layer.drawn_count == count) {
+				ret[layer_num] = LAYER_ACTION_SKIP;
+			} else {
+				layer.is_clear = false;
+				layer.drawn_version = state.version;
+				layer.drawn_count = count;
+			}
+			if (ret[layer_num] == LAYER_ACTION_SKIP)
+				layer_skip_count++;
+		}
+		return (ret);
+	}
+
+	void set_retained_object_count(uint32_t layer_index, uint32_t count)
+	{
+		vretained_layers[layer_index].object_count = std::min(count, info.ObjectMax);
+	}
+
+	void flush_retained_objects(frame_info_t & ref)
+	{
+		for (uint32_t layer_num = 0 ; layer_num < vretained_layers.size(); layer_num++) {
+			auto & rlayer = vretained_layers[layer_num];
+			if (rlayer.objects.empty())
+				continue;
+			auto & layer = ref.layers[layer_num];
+			auto dst = (object_format *)layer.host_memory_addr;
+			for (auto & range : layer.dirty_ranges) {
+				uint32_t count = range.last - range.first;
+				memcpy(dst + range.first, rlayer.objects.data() + range.first, sizeof(object_format) * count);
+				retained_upload_bytes += sizeof(object_format) * count;
+			}
+			layer.dirty_ranges.clear();
+			draw_triangles(layer_num, rlayer.object_count * 6);
+		}
+	}
+
+	//[ret, end) of the current frame belongs to the caller, ret == end when the layer is full.
+	//cursor_end is the cursor after this reservation, for release_sprites.
+	uint32_t reserve_sprites(uint32_t layer_index, uint32_t count, uint32_t & end, uint32_t & cursor_end)
+	{
+		auto & slayer = vsprite_layers[layer_index];
+		if (!slayer.is_used.load(std::memory_order_relaxed))
+			slayer.is_used.store(true, std::memory_order_relaxed);
+		uint32_t first = slayer.cursor.fetch_add(count, std::memory_order_relaxed);
+		cursor_end = first + count;
+		first = std::min(first, info.ObjectMax);
+		end = std::min(first + count, info.ObjectMax);
+		return (first);
+	}
+
+	//moves the cursor back to first if the last reservation still ends at cursor_end.
+	bool release_sprites(uint32_t layer_index, uint32_t first, uint32_t cursor_end)
+	{
+		auto & slayer = vsprite_layers[layer_index];
+		return (slayer.cursor.compare_exchange_strong(cursor_end, first, std::memory_order_relaxed));
+	}
+
+	//objects reserved so far in the current frame, the count submit() will draw.
+	uint32_t get_sprite_count(uint32_t layer_index)
+	{
+		return (std::min(vsprite_layers[layer_index].cursor.load(std::memory_order_relaxed), info.ObjectMax));
+	}
+
+	//the cursor is the object count of the frame, it restarts at 0 for the next one.
+	void flush_sprite_layers()
+	{
+		for (uint32_t layer_num = 0 ; layer_num < vsprite_layers.size(); layer_num++) {
+			auto & slayer = vsprite_layers[layer_num];
+			if (!slayer.is_used.load(std::memory_order_relaxed))
+				continue;
+			uint32_t count = std::min(slayer.cursor.exchange(0, std::memory_order_relaxed), info.ObjectMax);
+			draw_triangles(layer_num, count * 6);
+		}
+	}
+
+	//pinned until the slot is replaced. src is RGBA8 or blocks of a BC format.
+	void upload_user_image(uint32_t slot, uint32_t width, uint32_t height, void *src, VkFormat format = VK_FORMAT_R8G8B8A8_UNORM)
+	{
+		if (slot >= vuser_images.size())
+			return;
+		auto & uimg = vuser_images[slot];
+		retire_user_image(uimg);
+		uimg.source = nullptr;
+		uimg.format = format;
+		vuser_image_loads[slot] = {};
+		create_user_image(uimg, width, height, src);
+		user_image_resident_bytes += uimg.alloc_image.size;
+		mark_user_image(slot);
+	}
+
+	//the mapped blob is copied once, straight into the staging ring.
+	//assetpack_t::validate has checked the format and that the blob covers the image.
+	bool upload_asset(uint32_t slot, const assetpack_t & pack, const char *name)
+	{
+		static_assert(assetpack_t::FormatRGBA8 == VK_FORMAT_R8G8B8A8_UNORM, "assetpack format");
+		static_assert(assetpack_t::FormatBC1 == VK_FORMAT_BC1_RGBA_UNORM_BLOCK, "assetpack format");
+		static_assert(assetpack_t::FormatBC3 == VK_FORMAT_BC3_UNORM_BLOCK, "assetpack format");
+		static_assert(assetpack_t::FormatBC7 == VK_FORMAT_BC7_UNORM_BLOCK, "assetpack format");
+		auto e = pack.find(name);
+		if (!e)
+			return (false);
+		upload_user_image(slot, e->width, e->height, (void *)pack.data(*e), (VkFormat)e->format);
+		return (true);
+	}
+
+	//source fills width * height RGBA8 texels on a worker thread, once : a BC format is encoded there too,
+	//and the result is kept on the CPU, so an evicted image is only copied again.
+	//a pending load of the slot is waited for.
+	void set_user_image_source(uint32_t slot, uint32_t width, uint32_t height, std::function<void(void *)> source, VkFormat format = VK_FORMAT_R8G8B8A8_UNORM)
+	{
+		if (slot >= vuser_images.size())
+			return;
+		auto & uimg = vuser_images[slot];
+		retire_user_image(uimg);
+		uimg.width = width;
+		uimg.height = height;
+		uimg.format = format;
+		if (get_bc_format(format) != UINT32_MAX && !is_bc_supported)
+			uimg.format = VK_FORMAT_R8G8B8A8_UNORM;
+		uimg.source = source;
+		vuser_image_loads[slot] = {};
+		mark_user_image(slot);
+		is_user_image_tracked = true;
+	}
+
+	void create_user_image(user_image_t & uimg, uint32_t width, uint32_t height, void *src)
+	{
+		//BC images are 4x4 blocks, copied in whole blocks and never written by shaders.
+		uint32_t bc_format = get_bc_format(uimg.format);
+		VkDeviceSize size = width * height * sizeof(uint32_t);
+		VkImageUsageFlags usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+		uint32_t row_length = width;
+		uint32_t image_height = height;
+		if (bc_format != UINT32_MAX && !is_bc_supported) {
+			printf("BC formats are not supported : decode to R8G8B8A8_UNORM\n");
+			bc_decode_texels.resize(width * height);
+			bc_decode_image(bc_format, width, height, (const uint8_t *)src, bc_decode_texels.data());
+			src = bc_decode_texels.data();
+			uimg.format = VK_FORMAT_R8G8B8A8_UNORM;
+			bc_format = UINT32_MAX;
+		}
+		if (bc_format != UINT32_MAX) {
+			size = bc_image_bytes(bc_format, width, height);
+			usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+			row_length = (width + 3) & ~3;
+			image_height = (height + 3) & ~3;
+		}
+
+		//the full chain when UserImageMips, only RGBA8 can be a storage image.
+		uimg.mip_levels = 1;
+		if (cp_mip_generate && bc_format == UINT32_MAX)
+			while (uimg.mip_levels < MipMax && (std::max(width, height) >> uimg.mip_levels) > 0)
+				uimg.mip_levels++;
+
+		uimg.width = width;
+		uimg.height = height;
+		uimg.image = create_image(device, width, height, uimg.format, usage, &uimg.info, uimg.mip_levels);
+		uimg.alloc_image = allocator.bind_image(uimg.image, DeviceLocalFlags);
+		uimg.image_view = create_image_view(device, uimg.image, uimg.format, VK_IMAGE_ASPECT_COLOR_BIT, nullptr, 0, uimg.mip_levels);
+		uimg.mip_views.clear();
+		for (uint32_t level = 0 ; uimg.mip_levels > 1 && level < uimg.mip_levels; level++)
+			uimg.mip_views.push_back(create_image_view(device, uimg.image, uimg.format, VK_IMAGE_ASPECT_COLOR_BIT, nullptr, level, 1));
+
+		VkDescriptorSet mip_descriptor_set = alloc_mip_descriptor_set(uimg);
+
+		//larger than the whole ring : one shot staging buffer, waited right here.
+		VkBuffer src_buffer = staging_buffer;
+		VkDeviceSize src_offset = 0;
+		vkallocator_t::allocation_t alloc_temp;
+		if (!alloc_staging(size, src_offset)) {
+			flush_uploads();
+			src_buffer = create_buffer(device, size);
+			alloc_temp = allocator.bind_buffer(src_buffer, HostFlags);
+			memcpy(alloc_temp.mapped, src, size);
+		} else {
+			memcpy((uint8_t *)alloc_staging_ring.mapped + src_offset, src, size);
 		}
 
-		map_and_copy_devmem(device, uimg.devmem_buffer, 0, size, src);
 		VkBufferImageCopy copy_region = {};
-		copy_region.bufferOffset = 0;
-		copy_region.bufferRowLength = width;
-		copy_region.bufferImageHeight = height;
+		copy_region.bufferOffset = src_offset;
+		copy_region.bufferRowLength = row_length;
+		copy_region.bufferImageHeight = image_height;
 		copy_region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
 		copy_region.imageOffset = {0, 0, 0};
 		copy_region.imageExtent = {width, height, 1};
 
-		uimg.transfer_cmdbuf = create_command_buffer(device, cmd_pool);
-		vkResetCommandBuffer(uimg.transfer_cmdbuf, 0);
+		//a full ring flushes the uploads, and the descriptor pool with them.
+		if (!vframe_infos[backbuffer_index].is_upload_recording)
+			mip_descriptor_set = alloc_mip_descriptor_set(uimg);
+		auto cmdbuf = begin_upload_cmdbuf();
+		if (transfer_queue) {
+			//the copy runs on the transfer queue, level 0 is then handed over to the graphics family.
+			auto & ref = vframe_infos[backbuffer_index];
+			auto tcmdbuf = ref.transfer_cmdbuf;
+			uint32_t src_family = transfer_queue_family_index;
+			uint32_t dst_family = graphics_queue_family_index;
+			if (src_family == dst_family)
+				src_family = dst_family = VK_QUEUE_FAMILY_IGNORED;
+			VkPipelineStageFlags stage = mip_descriptor_set ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+			set_image_memory_barrier(tcmdbuf, uimg.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+			vkCmdCopyBufferToImage(tcmdbuf, src_buffer, uimg.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
+			set_image_ownership_barrier(tcmdbuf, uimg.image, VK_IMAGE_ASPECT_COLOR_BIT,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, src_family, dst_family,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, 0);
+			//the acquire also chains the semaphore wait to the later frames, which do not wait on it.
+			auto old_layout = src_family != dst_family ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+			set_image_ownership_barrier(cmdbuf, uimg.image, VK_IMAGE_ASPECT_COLOR_BIT,
+				old_layout, VK_IMAGE_LAYOUT_GENERAL, src_family, dst_family,
+				stage, stage, 0, VK_ACCESS_SHADER_READ_BIT);
+			ref.transfer_wait_stages |= stage;
+		} else {
+			set_image_memory_barrier(cmdbuf, uimg.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+			vkCmdCopyBufferToImage(cmdbuf, src_buffer, uimg.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
+			set_image_memory_barrier(cmdbuf, uimg.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+		}
+		if (mip_descriptor_set)
+			cmd_generate_mips(cmdbuf, uimg, mip_descriptor_set);
+		if (src_buffer != staging_buffer) {
+			flush_uploads();
+			vkDestroyBuffer(device, src_buffer, nullptr);
+			allocator.free(alloc_temp);
+		}
+	}
+
+	//from the pool of the current frame, before any ring space is taken.
+	VkDescriptorSet alloc_mip_descriptor_set(const user_image_t & uimg)
+	{
+		if (uimg.mip_levels <= 1)
+			return VK_NULL_HANDLE;
+		begin_upload_cmdbuf();
+		auto ret = create_descriptor_set(device, vframe_infos[backbuffer_index].mip_descriptor_pool, mip_descriptor_set_layout);
+		if (ret == VK_NULL_HANDLE) {
+			//the pool of this frame is used up, start over after the pending uploads.
+			flush_uploads();
+			begin_upload_cmdbuf();
+			ret = create_descriptor_set(device, vframe_infos[backbuffer_index].mip_descriptor_pool, mip_descriptor_set_layout);
+		}
+		return (ret);
+	}
+
+	//one dispatch of mip_generate.glsl, level 0 is already in VK_IMAGE_LAYOUT_GENERAL.
+	void cmd_generate_mips(VkCommandBuffer cmdbuf, user_image_t & uimg, VkDescriptorSet dset)
+	{
+		for (uint32_t i = 0 ; i < MipMax; i++)
+			update_descriptor_storage_image(device, dset, 0, i, uimg.mip_views[std::min(i, uimg.mip_levels - 1)]);
+		update_descriptor_storage_buffer(device, dset, 1, 0, mip_counter_buffer, sizeof(uint32_t));
+
+		//32x32 texels of level 0 per workgroup.
+		uint32_t push[4] = {
+			uimg.width, uimg.height, uimg.mip_levels,
+			((uimg.width + 31) / 32) * ((uimg.height + 31) / 32),
+		};
+		set_image_memory_barrier(cmdbuf, uimg.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1, uimg.mip_levels - 1);
+		set_memory_barrier(cmdbuf,
+			VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+		vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, cp_mip_generate);
+		vkCmdBindDescriptorSets(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, mip_pipeline_layout, 0, 1, &dset, 0, NULL);
+		vkCmdPushConstants(cmdbuf, mip_pipeline_layout, VK_SHADER_STAGE_ALL_GRAPHICS | VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), push);
+		vkCmdDispatch(cmdbuf, (uimg.width + 31) / 32, (uimg.height + 31) / 32, 1);
+		set_memory_barrier(cmdbuf,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+	}
+
+	//the frames still in flight may sample it, so it is destroyed FramesInFlight frames later.
+	void retire_user_image(user_image_t & uimg)
+	{
+		if (uimg.image == VK_NULL_HANDLE)
+			return;
+		user_image_resident_bytes -= uimg.alloc_image.size;
+		uimg.retire_frame = frame_count;
+		vretired_user_images.push_back(uimg);
+		uimg.image = VK_NULL_HANDLE;
+		uimg.image_view = VK_NULL_HANDLE;
+		uimg.alloc_image = {};
+		uimg.mip_views.clear();
+	}
+
+	void destroy_retired_user_images()
+	{
+		for (size_t i = 0 ; i < vretired_user_images.size(); ) {
+			auto & uimg = vretired_user_images[i];
+			if (uimg.retire_frame + vframe_infos.size() > frame_count) {
+				i++;
+				continue;
+			}
+			vkDestroyImageView(device, uimg.image_view, nullptr);
+			for (auto view : uimg.mip_views)
+				vkDestroyImageView(device, view, nullptr);
+			vkDestroyImage(device, uimg.image, nullptr);
+			allocator.free(uimg.alloc_image);
+			vretired_user_images.erase(vretired_user_images.begin() + i);
+		}
+	}
+
+	//each frame rewrites its own descriptor once its fence has signaled.
+	void mark_user_image(uint32_t slot)
+	{
+		for (uint32_t layer_num = 0 ; layer_num < vlayer_states.size(); layer_num++)
+			invalidate_layer(layer_num);
+		for (auto & frame : vframe_infos)
+			frame.dirty_user_images.push_back(slot);
+	}
+
+	//called after the fence of ref, so the set is not in use.
+	void update_user_image_descriptors(frame_info_t & ref)
+	{
+		if (ref.dirty_user_images.empty())
+			return;
+		for (auto slot : ref.dirty_user_images) {
+			auto image_view = vuser_images[slot].image_view;
+			if (image_view == VK_NULL_HANDLE)
+				image_view = placeholder_image.image_view;
+			update_descriptor_combined_image_sample(device, ref.descriptor_set_srv, 2, slot, image_view, sampler);
+		}
+		ref.dirty_user_images.clear();
+
+		//without update after bind the writes invalidate the command buffers that bound the set.
+		if (is_update_after_bind || ref.cmdbuf == VK_NULL_HANDLE)
+			return;
+		record_layers(ref, ref.vlayer_actions);
+		if (is_compute_composite)
+			for (uint32_t image_index = 0 ; image_index < ref.vpresent_cmdbufs.size(); image_index++)
+				record_present(ref, image_index);
+	}
+
+	//true once the source of the slot has run, the first call starts it.
+	bool poll_user_image_load(uint32_t slot)
+	{
+		auto & uimg = vuser_images[slot];
+		auto & load = vuser_image_loads[slot];
+		if (load.is_ready)
+			return (true);
+		if (!load.task.valid()) {
+			auto source = uimg.source;
+			uint32_t width = uimg.width;
+			uint32_t height = uimg.height;
+			uint32_t bc_format = get_bc_format(uimg.format);
+			load.task = std::async(std::launch::async, [ = ]() {
+				std::vector<uint8_t> ret(width * height * sizeof(uint32_t));
+				source(ret.data());
+				if (bc_format != UINT32_MAX) {
+					std::vector<uint8_t> blocks(bc_image_bytes(bc_format, width, height));
+					bc_encode_image(bc_format, width, height, (const uint32_t *)ret.data(), blocks.data());
+					ret.swap(blocks);
+				}
+				return (ret);
+			});
+		}
+		if (load.task.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return (false);
+		load.data = load.task.get();
+		load.is_ready = true;
+		return (true);
+	}
+
+	//the matid of every live object marks its user image as used. missing ones are loaded in the background
+	//and copied by the first frame that finds them ready, at most StagingRingBytes / FramesInFlight per frame
+	//so the ring does not have to wait, and the placeholder is drawn until then.
+	void track_user_images(frame_info_t & ref)
+	{
+		VkDeviceSize upload_budget = info.StagingRingBytes / vframe_infos.size();
+		VkDeviceSize upload_bytes = 0;
+		for (uint32_t layer_num = 0 ; layer_num < ref.layers.size(); layer_num++) {
+			auto obj = (const object_format *)ref.layers[layer_num].host_memory_addr;
+			uint32_t count = ref.host_layer_args[layer_num].object_count;
+			uint32_t last_matid = UINT32_MAX;
+			for (uint32_t i = 0 ; i < count; i++) {
+				uint32_t matid = obj[i].metadata[1];
+				if (obj[i].metadata[0] == 0 || matid == last_matid || matid >= vuser_images.size())
+					continue;
+				last_matid = matid;
+				auto & uimg = vuser_images[matid];
+				uimg.last_used_frame = frame_count;
+				if (uimg.image != VK_NULL_HANDLE || !uimg.source || !poll_user_image_load(matid))
+					continue;
+
+				//the first image of a frame always goes, a larger one than the ring still waits once.
+				auto & load = vuser_image_loads[matid];
+				if (upload_bytes && upload_bytes + load.data.size() > upload_budget)
+					continue;
+				upload_bytes += load.data.size();
+				create_user_image(uimg, uimg.width, uimg.height, load.data.data());
+				user_image_resident_bytes += uimg.alloc_image.size;
+				mark_user_image(matid);
+				user_image_load_count++;
+			}
+		}
+	}
+
+	//least recently used first, never one drawn by the current frame.
+	void evict_user_images()
+	{
+		while (info.UserImageBudget && user_image_resident_bytes > info.UserImageBudget) {
+			uint32_t victim = UINT32_MAX;
+			for (uint32_t slot = 0 ; slot < vuser_images.size(); slot++) {
+				auto & uimg = vuser_images[slot];
+				if (uimg.image == VK_NULL_HANDLE || !uimg.source || uimg.last_used_frame >= frame_count)
+					continue;
+				if (victim == UINT32_MAX || uimg.last_used_frame < vuser_images[victim].last_used_frame)
+					victim = slot;
+			}
+			if (victim == UINT32_MAX)
+				break;
+			retire_user_image(vuser_images[victim]);
+			mark_user_image(victim);
+			user_image_evict_count++;
+		}
+	}
+
+	//the uploads of the current frame go into its upload_cmdbuf, begun on first use.
+	VkCommandBuffer begin_upload_cmdbuf()
+	{
+		auto & ref = vframe_infos[backbuffer_index];
+		if (ref.is_upload_recording)
+			return ref.upload_cmdbuf;
+
+		//the previous submit of this frame may still read upload_cmdbuf.
+		vkWaitForFences(device, 1, &ref.fence, VK_TRUE, UINT64_MAX);
+		reclaim_staging(ref);
+		if (ref.mip_descriptor_pool)
+			vkResetDescriptorPool(device, ref.mip_descriptor_pool, 0);
+		vkResetCommandBuffer(ref.upload_cmdbuf, 0);
 		VkCommandBufferBeginInfo cmdbegininfo = {};
 		cmdbegininfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		cmdbegininfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-		vkBeginCommandBuffer(uimg.transfer_cmdbuf, &cmdbegininfo);
-		set_image_memory_barrier(uimg.transfer_cmdbuf, uimg.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-		vkCmdCopyBufferToImage(uimg.transfer_cmdbuf, uimg.buffer, uimg.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
-		set_image_memory_barrier(uimg.transfer_cmdbuf, uimg.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
-		vkEndCommandBuffer(uimg.transfer_cmdbuf);
-		vuser_images.push_back(uimg);
+		cmdbegininfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(ref.upload_cmdbuf, &cmdbegininfo);
+
+		//cmdbuf waited for transfer_sem, so the fence covers transfer_cmdbuf too.
+		if (transfer_queue) {
+			vkResetCommandBuffer(ref.transfer_cmdbuf, 0);
+			vkBeginCommandBuffer(ref.transfer_cmdbuf, &cmdbegininfo);
+		}
+		ref.is_upload_recording = true;
+		return ref.upload_cmdbuf;
+	}
+
+	//the copies are submitted to the transfer queue right away, the graphics side waits for them.
+	void end_upload_cmdbuf(
+		frame_info_t & ref,
+		std::vector<VkCommandBuffer> & vcmdbuf,
+		std::vector<VkSemaphore> & vwait_sem,
+		std::vector<VkPipelineStageFlags> & vwait_mask)
+	{
+		if (!ref.is_upload_recording)
+			return;
+		vkEndCommandBuffer(ref.upload_cmdbuf);
+		vcmdbuf.push_back(ref.upload_cmdbuf);
+		ref.is_upload_recording = false;
+		if (transfer_queue)
+			vkEndCommandBuffer(ref.transfer_cmdbuf);
+		if (ref.transfer_wait_stages) {
+			submit_command(device, {ref.transfer_cmdbuf}, transfer_queue, VK_NULL_HANDLE, {}, {}, {ref.transfer_sem});
+			vwait_sem.push_back(ref.transfer_sem);
+			vwait_mask.push_back(ref.transfer_wait_stages);
+			ref.transfer_wait_stages = 0;
+		}
+	}
+
+	//submit the pending uploads now and wait for every frame, the whole ring is free afterwards.
+	void flush_uploads()
+	{
+		auto & ref = vframe_infos[backbuffer_index];
+		if (ref.is_upload_recording) {
+			std::vector<VkCommandBuffer> vcmdbuf;
+			std::vector<VkSemaphore> vwait_sem;
+			std::vector<VkPipelineStageFlags> vwait_mask;
+			end_upload_cmdbuf(ref, vcmdbuf, vwait_sem, vwait_mask);
+			submit_command(device, vcmdbuf, graphics_queue, staging_fence, vwait_sem, vwait_mask, {});
+			vkWaitForFences(device, 1, &staging_fence, VK_TRUE, UINT64_MAX);
+		}
+		for (auto & frame : vframe_infos)
+			vkWaitForFences(device, 1, &frame.fence, VK_TRUE, UINT64_MAX);
+
+		//restart at the top of the ring.
+		uint64_t ring_size = info.StagingRingBytes;
+		staging_head = (staging_head + ring_size - 1) / ring_size * ring_size;
+		staging_tail = staging_head;
+	}
+
+	//the frame has retired, so has everything it read from the ring.
+	void reclaim_staging(frame_info_t & frame)
+	{
+		staging_tail = std::max(staging_tail, frame.staging_end);
+	}
+
+	//staging_head and staging_tail only grow, the offset in the ring is pos % StagingRingBytes.
+	bool alloc_staging(VkDeviceSize size, VkDeviceSize & offset)
+	{
+		uint64_t ring_size = info.StagingRingBytes;
+		uint64_t head = 0;
+		size = (size + StagingAlign - 1) & ~(StagingAlign - 1);
+		if (size > ring_size)
+			return (false);
+
+		//an upload never wraps, it skips the rest of the ring instead.
+		auto is_fit = [&]() {
+			head = staging_head;
+			if (head % ring_size + size > ring_size)
+				head += ring_size - head % ring_size;
+			return (head + size - staging_tail <= ring_size);
+		};
+
+		//wait for the oldest frames first.
+		for (uint32_t i = 0 ; i < vframe_infos.size() && !is_fit(); i++) {
+			auto & frame = vframe_infos[(backbuffer_index + i) % vframe_infos.size()];
+			vkWaitForFences(device, 1, &frame.fence, VK_TRUE, UINT64_MAX);
+			reclaim_staging(frame);
+		}
+
+		//the uploads of this frame alone fill the ring.
+		if (!is_fit()) {
+			flush_uploads();
+			is_fit();
+		}
+		offset = head % ring_size;
+		staging_head = head + size;
+		return (true);
 	}
 
 	uint32_t graphics_queue_family_index = -1;
+	uint32_t transfer_queue_family_index = UINT32_MAX;
 	uint32_t gpu_count = 0;
 	VkPhysicalDeviceProperties gpu_props = {};
 	VkBool32 presentSupport = false;
@@ -163,34 +967,176 @@ struct vkcontext_t {
 	VkCommandPool cmd_pool = VK_NULL_HANDLE;
 	VkSwapchainKHR swapchain = VK_NULL_HANDLE;
 	VkQueue graphics_queue = VK_NULL_HANDLE;
+	VkQueue transfer_queue = VK_NULL_HANDLE;
+	VkCommandPool transfer_cmd_pool = VK_NULL_HANDLE;
 	VkSampler sampler = VK_NULL_HANDLE;
-	VkDeviceMemory devmem_host = VK_NULL_HANDLE;
-	VkDeviceMemory devmem_local = VK_NULL_HANDLE;
+	vkallocator_t allocator;
 	VkDescriptorPool descriptor_pool = VK_NULL_HANDLE;
 	VkPipelineLayout pipeline_layout = VK_NULL_HANDLE;
 	VkDescriptorSetLayout descriptor_set_layout_srv = VK_NULL_HANDLE;
 	VkDescriptorSetLayout descriptor_set_layout_cbv = VK_NULL_HANDLE;
 	VkDescriptorSetLayout descriptor_set_layout_uav = VK_NULL_HANDLE;
+	VkBuffer readback_buffer = VK_NULL_HANDLE;
+	vkallocator_t::allocation_t alloc_readback;
+	VkCommandBuffer readback_cmdbuf = VK_NULL_HANDLE;
+	VkFence readback_fence = VK_NULL_HANDLE;
+	VkBuffer staging_buffer = VK_NULL_HANDLE;
+	vkallocator_t::allocation_t alloc_staging_ring;
+	VkFence staging_fence = VK_NULL_HANDLE;
+	uint64_t staging_head = 0;
+	uint64_t staging_tail = 0;
 	VkRenderPass render_pass = VK_NULL_HANDLE;
 	VkPipeline cp_update_buffer = VK_NULL_HANDLE;
+	VkPipeline cp_mip_generate = VK_NULL_HANDLE;
+	VkPipelineLayout mip_pipeline_layout = VK_NULL_HANDLE;
+	VkDescriptorSetLayout mip_descriptor_set_layout = VK_NULL_HANDLE;
+	VkBuffer mip_counter_buffer = VK_NULL_HANDLE;
+	vkallocator_t::allocation_t alloc_mip_counter;
+	VkPipeline cp_composite = VK_NULL_HANDLE;
+	VkPipelineLayout composite_pipeline_layout = VK_NULL_HANDLE;
+	VkDescriptorSetLayout composite_descriptor_set_layout = VK_NULL_HANDLE;
+	VkDescriptorPool composite_descriptor_pool = VK_NULL_HANDLE;
+	bool is_compute_composite = false;
+	std::vector<VkPipeline> vcp_sorts;
 	std::vector<VkPipeline> vgp_draw_rects;
 	std::vector<frame_info_t> vframe_infos;
+	std::vector<swapchain_image_t> vswapchain_images;
+	uint32_t present_index = 0;
+	VkSemaphore frame_timeline = VK_NULL_HANDLE;
+	bool is_frame_begun = false;
+
+	//cpu time blocked in begin_frame (frame slot) and end_frame (swapchain image), in ns.
+	struct frame_stats_t {
+		uint64_t begin_wait_ns = 0;
+		uint64_t end_wait_ns = 0;
+		uint64_t begin_wait_total_ns = 0;
+		uint64_t end_wait_total_ns = 0;
+	};
+	frame_stats_t frame_stats;
+	VkSurfaceCapabilitiesKHR surface_capabilities = {};
 	std::vector<user_image_t> vuser_images;
+	std::vector<user_image_load_t> vuser_image_loads;
+	std::vector<user_image_t> vretired_user_images;
+	std::vector<retained_layer_t> vretained_layers;
+	std::vector<sprite_layer_t> vsprite_layers;
+	std::vector<layer_state_t> vlayer_states;
+	uint64_t cmdbuf_record_count = 0;
+	uint64_t layer_skip_count = 0;
+	uint64_t retained_upload_bytes = 0;
+	std::vector<uint32_t> bc_decode_texels;
+	bool is_bc_supported = false;
+	bool is_update_after_bind = false;
+	user_image_t placeholder_image;
+	bool is_user_image_tracked = false;
+	uint64_t user_image_resident_bytes = 0;
+	uint64_t user_image_load_count = 0;
+	uint64_t user_image_evict_count = 0;
 
-	uint64_t devmem_local_offset = 0;
 	uint64_t backbuffer_index = 0;
 	uint64_t frame_count = 0;
 
+	static constexpr VkMemoryPropertyFlags DeviceLocalFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	static constexpr VkMemoryPropertyFlags HostFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	static constexpr VkDeviceSize StagingAlign = 256;
+	static constexpr uint32_t DirtyRangeMax = 64;
+	static constexpr uint32_t SpriteChunk = 256;
+
+	//MIP_MAX of mip_generate.glsl, up to 4096x4096.
+	static constexpr uint32_t MipMax = 13;
+
+	VkPresentModeKHR get_present_mode()
+	{
+		VkPresentModeKHR ret = VK_PRESENT_MODE_FIFO_KHR;
+		if (info.PresentMode == PRESENT_MODE_MAILBOX)
+			ret = VK_PRESENT_MODE_MAILBOX_KHR;
+		if (info.PresentMode == PRESENT_MODE_IMMEDIATE)
+			ret = VK_PRESENT_MODE_IMMEDIATE_KHR;
+		if (ret != VK_PRESENT_MODE_FIFO_KHR && !is_present_mode_supported(gpudev, surface, ret)) {
+			printf("present mode %d is not supported : fallback to FIFO\n", info.PresentMode);
+			ret = VK_PRESENT_MODE_FIFO_KHR;
+		}
+		return (ret);
+	}
+
+	//FrameFifoMax is only a hint for the swapchain, mailbox needs one spare image.
+	uint32_t get_swapchain_min_count()
+	{
+		uint32_t ret = std::max(info.FrameFifoMax, surface_capabilities.minImageCount);
+		if (info.PresentMode == PRESENT_MODE_MAILBOX)
+			ret = std::max(ret, 3u);
+		if (surface_capabilities.maxImageCount)
+			ret = std::min(ret, surface_capabilities.maxImageCount);
+		return (ret);
+	}
+
+	uint32_t get_vertex_stride()
+	{
+		if (info.VertexFormat == VERTEX_FORMAT_PACKED_FLOAT)
+			return sizeof(vertex_packed_float_format);
+		if (info.VertexFormat == VERTEX_FORMAT_PACKED_HALF)
+			return sizeof(vertex_packed_half_format);
+		return sizeof(vertex_format);
+	}
+
+	//pos, uv, color, matid. the vertex shaders see the same vec4/uint inputs.
+	std::vector<VkFormat> get_vertex_attribute_formats()
+	{
+		if (info.VertexFormat == VERTEX_FORMAT_PACKED_FLOAT)
+			return {VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R16G16_UNORM, VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R16_UINT};
+		if (info.VertexFormat == VERTEX_FORMAT_PACKED_HALF)
+			return {VK_FORMAT_R16G16_SFLOAT, VK_FORMAT_R16G16_UNORM, VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R16_UINT};
+		return {VK_FORMAT_R32G32B32A32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT, VK_FORMAT_R32G32B32A32_UINT};
+	}
+
 	void init(create_info & userinfo)
 	{
 		info = userinfo;
 		info.DescriptorPoolMax = info.LayerMax * info.DescriptorArrayMax;
 		info.ObjectMaxBytes = info.ObjectMax * sizeof(vkcontext_t::object_format);
-		info.VertexMaxBytes = info.ObjectMax * sizeof(vkcontext_t::vertex_format) * 6;
+		info.VertexMaxBytes = info.ObjectMax * get_vertex_stride() * 6;
+		info.VertexMaxBytes = (info.VertexMaxBytes + 255) & ~255ULL;
+		if (info.CpuExpand && info.VertexFormat != VERTEX_FORMAT_FLOAT) {
+			printf("CpuExpand needs VERTEX_FORMAT_FLOAT : fallback to compute\n");
+			info.CpuExpand = false;
+		}
 		info.DrawIndirectCommandSize = 4096;
+		if (info.MemoryBlockSize == 0)
+			info.MemoryBlockSize = 64 * 1024 * 1024;
+		if (info.StagingRingBytes == 0)
+			info.StagingRingBytes = 16 * 1024 * 1024;
+		info.StagingRingBytes = (info.StagingRingBytes + StagingAlign - 1) & ~(StagingAlign - 1);
+		if (info.DrawMode != DRAW_MODE_EXPAND) {
+			//no expanded vertices and no compute pass.
+			info.VertexMaxBytes = 0;
+			info.CpuExpand = false;
+		}
+		if (info.WorkgroupSize == 0)
+			info.WorkgroupSize = 64;
+
+		//ticket + one prefix per workgroup, see update_buffer.glsl.
+		info.ScanMaxBytes = sizeof(uint32_t) * (1 + (info.ObjectMax + info.WorkgroupSize - 1) / info.WorkgroupSize);
+		info.ScanMaxBytes = (info.ScanMaxBytes + 255) & ~255ULL;
+
+		//keys[2][ObjectMax], vals[2][ObjectMax], hist[16][workgroups], see sort_objects.glsl.
+		info.SortMaxBytes = sizeof(uint32_t) * (4 * info.ObjectMax + 16 * ((info.ObjectMax + info.WorkgroupSize - 1) / info.WorkgroupSize));
+		info.SortMaxBytes = (info.SortMaxBytes + 255) & ~255ULL;
+		if (info.DrawMode != DRAW_MODE_EXPAND) {
+			info.ScanMaxBytes = 0;
+			info.SortMaxBytes = 0;
+		}
 
-		vframe_infos.resize(info.FrameFifoMax);
-		VkInstance inst = create_instance(info.appname);
+#ifndef _WIN32
+		if (!info.Headless) {
+			printf("no window system : fallback to headless\n");
+			info.Headless = true;
+		}
+#endif //_WIN32
+		if (info.FramesInFlight == 0)
+			info.FramesInFlight = info.FrameFifoMax;
+		if (info.FrameLatency == 0 || info.FrameLatency > info.FramesInFlight)
+			info.FrameLatency = info.FramesInFlight;
+		vframe_infos.resize(info.FramesInFlight);
+		VkInstance inst = create_instance(info.appname, info.Headless);
 		auto err = vkEnumeratePhysicalDevices(inst, &gpu_count, NULL);
 		err = vkEnumeratePhysicalDevices(inst, &gpu_count, &gpudev);
 		vkGetPhysicalDeviceProperties(gpudev, &gpu_props);
@@ -216,33 +1162,98 @@ struct vkcontext_t {
 			}
 		}
 
-		surface = create_win32_surface(inst, info.hwnd, GetModuleHandle(NULL));
-		vkGetPhysicalDeviceSurfaceSupportKHR(gpudev, 0, surface, &presentSupport);
-		VkSurfaceCapabilitiesKHR capabilities = {};
-		vkGetPhysicalDeviceSurfaceCapabilitiesKHR(gpudev, surface, &capabilities);
+#ifdef _WIN32
+		if (!info.Headless) {
+			surface = create_win32_surface(inst, info.hwnd, GetModuleHandle(NULL));
+			vkGetPhysicalDeviceSurfaceSupportKHR(gpudev, 0, surface, &presentSupport);
+			vkGetPhysicalDeviceSurfaceCapabilitiesKHR(gpudev, surface, &surface_capabilities);
+		}
+#endif //_WIN32
 
 		graphics_queue_family_index = get_graphics_queue_index(gpudev);
-		device = create_device(gpudev, graphics_queue_family_index);
+		VkPhysicalDeviceFeatures features = {};
+		vkGetPhysicalDeviceFeatures(gpudev, &features);
+		is_bc_supported = features.textureCompressionBC;
+		if (info.AsyncTransfer)
+			transfer_queue_family_index = get_transfer_queue_index(gpudev, graphics_queue_family_index);
+		bool is_timeline = is_timeline_semaphore_supported(gpudev);
+		if (info.ComputeComposite && !info.cs_composite.empty()) {
+			is_compute_composite = is_compute_composite_supported(features);
+			if (!is_compute_composite)
+				printf("ComputeComposite : no storage output, falling back to the present pass\n");
+		}
+		//mip_generate.glsl indexes mips[] with the level.
+		if (info.UserImageMips && !features.shaderStorageImageArrayDynamicIndexing) {
+			printf("UserImageMips : no storage image array indexing, mips are not generated\n");
+			info.UserImageMips = false;
+		}
+		is_update_after_bind = is_update_after_bind_supported(gpudev);
+		if (!is_update_after_bind)
+			printf("no update after bind : the command buffers are recorded again after tex_user changes\n");
+		device = create_device(gpudev, graphics_queue_family_index, info.Headless, is_bc_supported, transfer_queue_family_index, is_timeline, is_compute_composite, is_update_after_bind, info.UserImageMips);
+		if (is_timeline)
+			frame_timeline = create_timeline_semaphore(device);
 
+		allocator.init(gpudev, device, info.MemoryBlockSize, info.GpuMemoryMax);
 		create_resources();
 	}
 
+	//composite.glsl writes out_image without a format, the swapchain image also needs the storage usage.
+	bool is_compute_composite_supported(const VkPhysicalDeviceFeatures & features)
+	{
+		if (!features.shaderStorageImageWriteWithoutFormat)
+			return (false);
+		if (info.Headless)
+			return (true);
+		VkFormatProperties props = {};
+		vkGetPhysicalDeviceFormatProperties(gpudev, VK_FORMAT_B8G8R8A8_UNORM, &props);
+		if (!(props.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT))
+			return (false);
+		return ((surface_capabilities.supportedUsageFlags & VK_IMAGE_USAGE_STORAGE_BIT) != 0);
+	}
+
 	void create_resources()
 	{
 		cmd_pool = create_cmd_pool(device, graphics_queue_family_index);
-		swapchain = create_swapchain(device, surface, info.ScreenW, info.ScreenH, info.FrameFifoMax);
 		sampler = create_sampler(device, true);
 		vkGetDeviceQueue(device, graphics_queue_family_index, 0, &graphics_queue);
+		if (transfer_queue_family_index != UINT32_MAX) {
+			uint32_t queue_index = transfer_queue_family_index == graphics_queue_family_index ? 1 : 0;
+			vkGetDeviceQueue(device, transfer_queue_family_index, queue_index, &transfer_queue);
+			transfer_cmd_pool = create_cmd_pool(device, transfer_queue_family_index);
+			printf("transfer queue : family %d, queue %d\n", transfer_queue_family_index, queue_index);
+		}
+		staging_buffer = create_buffer(device, info.StagingRingBytes);
+		alloc_staging_ring = allocator.bind_buffer(staging_buffer, HostFlags);
+		staging_fence = create_fence(device);
 		std::vector<VkImage> temp;
-		{
+		VkImageUsageFlags output_usage = is_compute_composite ? VK_IMAGE_USAGE_STORAGE_BIT : 0;
+		VkFormat output_format = info.Headless ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_B8G8R8A8_UNORM;
+		if (info.Headless) {
+			//offscreen targets take the place of the swapchain images, one per frame in flight.
+			temp.resize(vframe_infos.size());
+			for (auto & image : temp)
+				image = create_image(device, info.ScreenW, info.ScreenH, output_format, VK_IMAGE_USAGE_SAMPLED_BIT | output_usage);
+		} else {
 			uint32_t swapchain_count = 0;
+			swapchain = create_swapchain(device, surface, info.ScreenW, info.ScreenH, get_swapchain_min_count(), get_present_mode(), output_usage);
 			vkGetSwapchainImagesKHR(device, swapchain, &swapchain_count, nullptr);
 			temp.resize(swapchain_count);
 			vkGetSwapchainImagesKHR(device, swapchain, &swapchain_count, temp.data());
 		}
+		vswapchain_images.resize(temp.size());
+		for (uint32_t i = 0 ; i < temp.size(); i++) {
+			auto & simg = vswapchain_images[i];
+			simg.image = temp[i];
+			if (info.Headless)
+				simg.alloc_image = allocator.bind_image(simg.image, DeviceLocalFlags);
+			else
+				simg.render_sem = create_semaphore(device);
+		}
 
-		devmem_local = alloc_device_memory(gpudev, device, info.GpuMemoryMax, false);
-		descriptor_pool = create_descriptor_pool(device, info.DescriptorPoolMax);
+		VkDescriptorPoolCreateFlags pool_flags = is_update_after_bind ? VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT : 0;
+		VkDescriptorBindingFlags user_binding_flags = is_update_after_bind ? VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT : 0;
+		descriptor_pool = create_descriptor_pool(device, info.DescriptorPoolMax, 0xFF, pool_flags);
 		{
 			std::vector<VkDescriptorSetLayoutBinding> vdesc_setlayout_binding_srv;
 			std::vector<VkDescriptorSetLayoutBinding> vdesc_setlayout_binding_cbv;
@@ -254,7 +1265,11 @@ struct vkcontext_t {
 			vdesc_setlayout_binding_cbv.push_back({0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, info.DescriptorArrayMax, shader_stages, nullptr});
 			vdesc_setlayout_binding_uav.push_back({0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, shader_stages, nullptr});
 			vdesc_setlayout_binding_uav.push_back({1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, shader_stages, nullptr});
-			descriptor_set_layout_srv = create_descriptor_set_layout(device, vdesc_setlayout_binding_srv);
+			vdesc_setlayout_binding_uav.push_back({2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, shader_stages, nullptr});
+			vdesc_setlayout_binding_uav.push_back({3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, shader_stages, nullptr});
+			vdesc_setlayout_binding_uav.push_back({4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, shader_stages, nullptr});
+			//tex_user[] is rewritten by the residency while the recorded command buffers stay valid.
+			descriptor_set_layout_srv = create_descriptor_set_layout(device, vdesc_setlayout_binding_srv, {0, 0, user_binding_flags});
 			descriptor_set_layout_cbv = create_descriptor_set_layout(device, vdesc_setlayout_binding_cbv);
 			descriptor_set_layout_uav = create_descriptor_set_layout(device, vdesc_setlayout_binding_uav);
 			std::vector<VkDescriptorSetLayout> vdescriptor_layouts = {
@@ -262,123 +1277,399 @@ struct vkcontext_t {
 				descriptor_set_layout_cbv,
 				descriptor_set_layout_uav,
 			};
-			pipeline_layout = create_pipeline_layout(device, vdescriptor_layouts.data(), vdescriptor_layouts.size());
+			pipeline_layout = create_pipeline_layout(device, vdescriptor_layouts.data(), vdescriptor_layouts.size(), sizeof(push_constant_t));
 		}
 		render_pass = create_render_pass(device, VK_FORMAT_R8G8B8A8_UNORM);
-		cp_update_buffer = create_cpipeline(device, pipeline_layout, info.cs_update);
+		cp_update_buffer = create_cpipeline(device, pipeline_layout, info.cs_update, {info.WorkgroupSize, info.VertexFormat});
+		for (uint32_t sort_pass = 0 ; sort_pass < 4; sort_pass++)
+			vcp_sorts.push_back(create_cpipeline(device, pipeline_layout, info.cs_sort, {info.WorkgroupSize, sort_pass}));
+		if (info.UserImageMips && !info.cs_mip.empty()) {
+			std::vector<VkDescriptorSetLayoutBinding> vdesc_setlayout_binding_mip;
+			vdesc_setlayout_binding_mip.push_back({0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MipMax, VK_SHADER_STAGE_COMPUTE_BIT, nullptr});
+			vdesc_setlayout_binding_mip.push_back({1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr});
+			mip_descriptor_set_layout = create_descriptor_set_layout(device, vdesc_setlayout_binding_mip);
+			mip_pipeline_layout = create_pipeline_layout(device, &mip_descriptor_set_layout, 1, sizeof(uint32_t) * 4);
+			cp_mip_generate = create_cpipeline(device, mip_pipeline_layout, info.cs_mip);
+
+			//zero at rest, the last workgroup of every dispatch resets it.
+			mip_counter_buffer = create_buffer(device, 256);
+			alloc_mip_counter = allocator.bind_buffer(mip_counter_buffer, HostFlags);
+			memset(alloc_mip_counter.mapped, 0, 256);
+		}
+		if (is_compute_composite) {
+			std::vector<VkDescriptorSetLayoutBinding> vdesc_setlayout_binding_composite;
+			vdesc_setlayout_binding_composite.push_back({0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr});
+			composite_descriptor_set_layout = create_descriptor_set_layout(device, vdesc_setlayout_binding_composite);
+
+			//set 0 is the srv set of the frame, set 1 the output image.
+			std::vector<VkDescriptorSetLayout> vdescriptor_layouts = {
+				descriptor_set_layout_srv,
+				composite_descriptor_set_layout,
+			};
+			composite_pipeline_layout = create_pipeline_layout(device, vdescriptor_layouts.data(), vdescriptor_layouts.size(), sizeof(composite_push_t));
+			cp_composite = create_cpipeline(device, composite_pipeline_layout, info.cs_composite);
+			composite_descriptor_pool = create_descriptor_pool(device, vswapchain_images.size(), vswapchain_images.size());
+			for (auto & simg : vswapchain_images) {
+				simg.storage_view = create_image_view(device, simg.image, output_format, VK_IMAGE_ASPECT_COLOR_BIT);
+				simg.composite_descriptor_set = create_descriptor_set(device, composite_descriptor_pool, composite_descriptor_set_layout);
+				update_descriptor_storage_image(device, simg.composite_descriptor_set, 0, 0, simg.storage_view);
+			}
+		}
 		vgp_draw_rects.resize(info.LayerMax);
 		for (int i = 0 ; i < info.LayerMax; i++) {
 			auto & shader = info.shader_layers[i];
-			vgp_draw_rects[i] = create_gpipeline(device, pipeline_layout, render_pass, shader.vs, shader.ps);
+			//fragment constant_id 0 : the layer index, present.glsl sums the layers below it.
+			std::vector<uint32_t> ps_spec_constants = {uint32_t(i)};
+			if (info.DrawMode == DRAW_MODE_PULL)
+				vgp_draw_rects[i] = create_gpipeline(device, pipeline_layout, render_pass, info.vs_pull, shader.ps, {}, 0, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, {}, ps_spec_constants);
+			else if (info.DrawMode == DRAW_MODE_INSTANCED)
+				vgp_draw_rects[i] = create_gpipeline(device, pipeline_layout, render_pass, info.vs_pull, shader.ps, {}, 0, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP, {1}, ps_spec_constants);
+			else
+				vgp_draw_rects[i] = create_gpipeline(device, pipeline_layout, render_pass, shader.vs, shader.ps, get_vertex_attribute_formats(), get_vertex_stride(), VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, {}, ps_spec_constants);
 		}
 
-		for (int i = 0 ; i < info.FrameFifoMax; i++) {
+		for (uint32_t i = 0 ; i < vframe_infos.size(); i++) {
 			auto & ref = vframe_infos[i];
 			ref.layers.resize(info.LayerMax);
-			uint8_t *temp_addr = nullptr;
-			ref.backbuffer_image = temp[i];
 			ref.fence = create_fence(device);
 			ref.sem = create_semaphore(device);
-			ref.devmem_host = alloc_device_memory(gpudev, device, info.LayerMax * info.ObjectMaxBytes, true);
-			ref.devmem_local_vertex = alloc_device_memory(gpudev, device, info.LayerMax * info.VertexMaxBytes, false);
-			ref.devmem_host_draw_indirect_cmd = alloc_device_memory(gpudev, device, info.DrawIndirectCommandSize, true);
+			ref.upload_cmdbuf = create_command_buffer(device, cmd_pool);
+			if (transfer_queue) {
+				ref.transfer_cmdbuf = create_command_buffer(device, transfer_cmd_pool);
+				ref.transfer_sem = create_semaphore(device);
+			}
+			if (cp_mip_generate)
+				ref.mip_descriptor_pool = create_descriptor_pool(device, MipMax * info.UserImageMax, info.UserImageMax);
+			bool is_expand = info.DrawMode == DRAW_MODE_EXPAND;
 			ref.indirect_draw_cmd_buffer = create_buffer(device, info.DrawIndirectCommandSize);
-			vkBindBufferMemory(device, ref.indirect_draw_cmd_buffer, ref.devmem_host_draw_indirect_cmd, 0);
-			vkMapMemory(device, ref.devmem_host, 0, info.LayerMax * info.ObjectMaxBytes, 0, (void **)&temp_addr);
-			vkMapMemory(device, ref.devmem_host_draw_indirect_cmd, 0, info.DrawIndirectCommandSize, 0, (void **)&ref.host_draw_indirect_cmd);
+			ref.alloc_indirect_draw_cmd = allocator.bind_buffer(ref.indirect_draw_cmd_buffer, HostFlags);
+			ref.host_layer_args = (layer_args_t *)ref.alloc_indirect_draw_cmd.mapped;
 
 			auto image_usage_flags = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
 			ref.descriptor_set_srv = create_descriptor_set(device, descriptor_pool, descriptor_set_layout_srv);
 			ref.descriptor_set_cbv = create_descriptor_set(device, descriptor_pool, descriptor_set_layout_cbv);
-			for (auto & layer : ref.layers) {
+			for (uint32_t layer_num = 0 ; layer_num < ref.layers.size(); layer_num++) {
+				auto & layer = ref.layers[layer_num];
 				layer.descriptor_set_uav = create_descriptor_set(device, descriptor_pool, descriptor_set_layout_uav);
-				layer.image = create_image(device, info.Width, info.Height, VK_FORMAT_R8G8B8A8_UNORM, image_usage_flags);
+				if (has_layer_image(layer_num)) {
+					layer.image = create_image(device, info.Width, info.Height, VK_FORMAT_R8G8B8A8_UNORM, image_usage_flags);
+					layer.alloc_image = allocator.bind_image(layer.image, DeviceLocalFlags);
+				}
 				layer.buffer = create_buffer(device, info.ObjectMaxBytes);
-				layer.vertex_buffer = create_buffer(device, info.VertexMaxBytes);
-				vkBindImageMemory(device, layer.image, devmem_local, devmem_local_offset);
-				vkBindBufferMemory(device, layer.buffer, ref.devmem_host, ref.devmem_host_offset);
-				vkBindBufferMemory(device, layer.vertex_buffer, ref.devmem_local_vertex, ref.devmem_local_vertex_offset);
-
-				devmem_local_offset += get_image_memreq_size(device, layer.image);
-				ref.devmem_host_offset += get_buffer_memreq_size(device, layer.buffer);
-				ref.devmem_local_vertex_offset += get_buffer_memreq_size(device, layer.vertex_buffer);
-				layer.host_memory_addr = temp_addr;
-				temp_addr += get_buffer_memreq_size(device, layer.buffer);
+				layer.alloc_buffer = allocator.bind_buffer(layer.buffer, HostFlags);
+				layer.host_memory_addr = layer.alloc_buffer.mapped;
+				if (is_expand) {
+					layer.vertex_buffer = create_buffer(device, info.VertexMaxBytes);
+					layer.scan_buffer = create_buffer(device, info.ScanMaxBytes);
+					layer.sort_buffer = create_buffer(device, info.SortMaxBytes);
+					layer.alloc_vertex = allocator.bind_buffer(layer.vertex_buffer, info.CpuExpand ? HostFlags : DeviceLocalFlags);
+					layer.alloc_scan = allocator.bind_buffer(layer.scan_buffer, DeviceLocalFlags);
+					layer.alloc_sort = allocator.bind_buffer(layer.sort_buffer, DeviceLocalFlags);
+					layer.host_vertex_addr = layer.alloc_vertex.mapped;
+				}
 			}
 
 			for (uint32_t layer_num = 0 ; layer_num < ref.layers.size(); layer_num++) {
 				auto & layer = ref.layers[layer_num];
+				if (!has_layer_image(layer_num))
+					continue;
 				layer.image_view = create_image_view(device, layer.image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
 				std::vector<VkImageView> vimageview = { layer.image_view, };
 				layer.framebuffer = create_framebuffer(device, render_pass, vimageview, info.Width, info.Height);
+			}
+
+			for (uint32_t layer_num = 0 ; layer_num < ref.layers.size(); layer_num++) {
+				auto & layer = ref.layers[layer_num];
+				auto & target = ref.layers[info.LayerMax - 1];
+				if (!has_layer_image(layer_num)) {
+					layer.image = target.image;
+					layer.image_view = target.image_view;
+					layer.framebuffer = target.framebuffer;
+				}
 				update_descriptor_combined_image_sample(device, ref.descriptor_set_srv, 0, layer_num, layer.image_view, sampler);
 				update_descriptor_storage_buffer(device, layer.descriptor_set_uav, 0, 0, layer.buffer, info.ObjectMaxBytes);
-				update_descriptor_storage_buffer(device, layer.descriptor_set_uav, 1, 0, layer.vertex_buffer, info.VertexMaxBytes);
+				update_descriptor_storage_buffer(device, layer.descriptor_set_uav, 2, 0, ref.indirect_draw_cmd_buffer, info.DrawIndirectCommandSize);
+				if (is_expand) {
+					update_descriptor_storage_buffer(device, layer.descriptor_set_uav, 1, 0, layer.vertex_buffer, info.VertexMaxBytes);
+					update_descriptor_storage_buffer(device, layer.descriptor_set_uav, 3, 0, layer.scan_buffer, info.ScanMaxBytes);
+					update_descriptor_storage_buffer(device, layer.descriptor_set_uav, 4, 0, layer.sort_buffer, info.SortMaxBytes);
+				}
 			}
 		}
-		for (int i = 0 ; i < info.FrameFifoMax; i++) {
+		for (uint32_t i = 0 ; i < vframe_infos.size(); i++) {
 			auto & ref = vframe_infos[i];
-			auto & prev_ref = vframe_infos[(i - 1) % info.FrameFifoMax];
+			auto & prev_ref = vframe_infos[(i + vframe_infos.size() - 1) % vframe_infos.size()];
 			for (uint32_t layer_num = 0 ; layer_num < ref.layers.size(); layer_num++) {
 				auto & layer = ref.layers[layer_num];
 				auto & prev_layer = prev_ref.layers[layer_num];
 				update_descriptor_combined_image_sample(device, ref.descriptor_set_srv, 1, layer_num, prev_layer.image_view, sampler);
 			}
 		}
+
+		//every tex_user slot is valid, the empty ones sample a white texel.
+		uint32_t white = 0xFFFFFFFF;
+		vuser_images.resize(info.UserImageMax);
+		vuser_image_loads = std::vector<user_image_load_t>(info.UserImageMax);
+		vretained_layers.resize(info.LayerMax);
+		vlayer_states.resize(info.LayerMax);
+		vsprite_layers = std::vector<sprite_layer_t>(info.LayerMax);
+		create_user_image(placeholder_image, 1, 1, &white);
+		for (auto & ref : vframe_infos)
+			for (uint32_t slot = 0 ; slot < info.UserImageMax; slot++)
+				update_descriptor_combined_image_sample(device, ref.descriptor_set_srv, 2, slot, placeholder_image.image_view, sampler);
+	}
+
+	//radix sort of one layer, the descriptor sets must be bound already.
+	void cmd_sort_objects(VkCommandBuffer cmdbuf, frame_info_t & ref, uint32_t layer_num)
+	{
+		VkDeviceSize dispatch_offset = sizeof(layer_args_t) * layer_num + offsetof(layer_args_t, dispatch);
+		push_constant_t push = {};
+		push.layer_index = layer_num;
+
+		auto compute_barrier = [&]() {
+			set_memory_barrier(cmdbuf,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+		};
+
+		vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, vcp_sorts[0]);
+		vkCmdPushConstants(cmdbuf, pipeline_layout, VK_SHADER_STAGE_ALL_GRAPHICS | VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+		vkCmdDispatchIndirect(cmdbuf, ref.indirect_draw_cmd_buffer, dispatch_offset);
+		compute_barrier();
+		for (push.shift = 0 ; push.shift < 32; push.shift += 4) {
+			vkCmdPushConstants(cmdbuf, pipeline_layout, VK_SHADER_STAGE_ALL_GRAPHICS | VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+			vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, vcp_sorts[1]);
+			vkCmdDispatchIndirect(cmdbuf, ref.indirect_draw_cmd_buffer, dispatch_offset);
+			compute_barrier();
+			vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, vcp_sorts[2]);
+			vkCmdDispatch(cmdbuf, 1, 1, 1);
+			compute_barrier();
+			vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, vcp_sorts[3]);
+			vkCmdDispatchIndirect(cmdbuf, ref.indirect_draw_cmd_buffer, dispatch_offset);
+			compute_barrier();
+		}
+	}
+
+	//SinglePass : the layer is drawn into the image of the last layer, in one render pass with the others.
+	bool is_composited(uint32_t layer_num)
+	{
+		if (!info.SinglePass)
+			return (false);
+		return (layer_num == info.LayerMax - 1 || !info.shader_layers[layer_num].is_offscreen);
+	}
+
+	//SinglePass : the present layer owns the target and samples it through tex[], so it is never drawn.
+	bool is_drawn_into_target(uint32_t layer_num)
+	{
+		return (is_composited(layer_num) && layer_num != info.LayerMax - 1);
+	}
+
+	//the composited layers share the image of the last layer.
+	bool has_layer_image(uint32_t layer_num)
+	{
+		return (!is_composited(layer_num) || layer_num == info.LayerMax - 1);
+	}
+
+	//compaction (and sort) of the objects into the vertex buffer, outside of any render pass.
+	void cmd_expand_layer(VkCommandBuffer cmdbuf, frame_info_t & ref, uint32_t layer_num)
+	{
+		//CpuExpand : the vertex buffer is already written by submit().
+		//DRAW_MODE_PULL, DRAW_MODE_INSTANCED : the vertex shader reads the objects itself.
+		if (info.DrawMode != DRAW_MODE_EXPAND || info.CpuExpand)
+			return;
+		auto & layer = ref.layers[layer_num];
+		std::vector<VkDescriptorSet> vdescriptor_sets = {
+			ref.descriptor_set_srv,
+			ref.descriptor_set_cbv,
+			layer.descriptor_set_uav,
+		};
+		vkCmdFillBuffer(cmdbuf, layer.scan_buffer, 0, VK_WHOLE_SIZE, 0);
+		set_memory_barrier(cmdbuf,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+		push_constant_t push = {};
+		push.layer_index = layer_num;
+		vkCmdBindDescriptorSets(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, vdescriptor_sets.size(), vdescriptor_sets.data(), 0, NULL);
+		if (info.shader_layers[layer_num].is_sorted && !info.cs_sort.empty()) {
+			cmd_sort_objects(cmdbuf, ref, layer_num);
+			push.flags |= PUSH_FLAG_SORTED;
+		}
+		vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, cp_update_buffer);
+		vkCmdPushConstants(cmdbuf, pipeline_layout, VK_SHADER_STAGE_ALL_GRAPHICS | VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+		vkCmdDispatchIndirect(cmdbuf, ref.indirect_draw_cmd_buffer, sizeof(layer_args_t) * layer_num + offsetof(layer_args_t, dispatch));
+
+		//the compacted vertices and vertexCount come from the compute pass.
+		set_memory_barrier(cmdbuf,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+			VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+	}
+
+	//inside the render pass of the target.
+	void cmd_draw_layer(VkCommandBuffer cmdbuf, frame_info_t & ref, uint32_t layer_num)
+	{
+		auto & layer = ref.layers[layer_num];
+		VkDeviceSize vertex_offsets[1] = {0};
+		std::vector<VkDescriptorSet> vdescriptor_sets = {
+			ref.descriptor_set_srv,
+			ref.descriptor_set_cbv,
+			layer.descriptor_set_uav,
+		};
+		vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, vgp_draw_rects[layer_num]);
+		vkCmdBindDescriptorSets(cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, vdescriptor_sets.size(), vdescriptor_sets.data(), 0, NULL);
+		if (layer.vertex_buffer)
+			vkCmdBindVertexBuffers(cmdbuf, 0, 1, &layer.vertex_buffer, vertex_offsets);
+		vkCmdDrawIndirect(cmdbuf, ref.indirect_draw_cmd_buffer, sizeof(layer_args_t) * layer_num + offsetof(layer_args_t, draw), 1, sizeof(layer_args_t));
+	}
+
+	//cmdbuf of the frame with one LAYER_ACTION_* per layer.
+	void record_layers(frame_info_t & ref, const std::vector<uint8_t> & vactions)
+	{
+		vkResetCommandBuffer(ref.cmdbuf, 0);
+		VkCommandBufferBeginInfo cmdbegininfo = {};
+		cmdbegininfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		cmdbegininfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+		vkBeginCommandBuffer(ref.cmdbuf, &cmdbegininfo);
+		for (uint32_t layer_num = 0 ; layer_num < ref.layers.size(); layer_num++) {
+			auto & layer = ref.layers[layer_num];
+			if (vactions[layer_num] == LAYER_ACTION_SKIP || is_composited(layer_num))
+				continue;
+
+			//ComputeComposite : the composite dispatch takes the place of the present layer.
+			if (is_compute_composite && !info.SinglePass && layer_num == info.LayerMax - 1)
+				continue;
+			if (vactions[layer_num] == LAYER_ACTION_DRAW)
+				cmd_expand_layer(ref.cmdbuf, ref, layer_num);
+			cmd_set_viewport(ref.cmdbuf, 0, 0, info.Width, info.Height);
+			set_image_memory_barrier(ref.cmdbuf, layer.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+			cmd_clear_image(ref.cmdbuf, layer.image, 0, 0, 0, 0);
+			if (vactions[layer_num] == LAYER_ACTION_CLEAR)
+				continue;
+			cmd_begin_render_pass(ref.cmdbuf, render_pass, layer.framebuffer, info.Width, info.Height);
+			cmd_draw_layer(ref.cmdbuf, ref, layer_num);
+			cmd_end_render_pass(ref.cmdbuf);
+		}
+
+		//SinglePass : the composited layers are blended in order into one target, one clear and one render pass.
+		if (info.SinglePass) {
+			auto & target = ref.layers[info.LayerMax - 1];
+			for (uint32_t layer_num = 0 ; layer_num < ref.layers.size(); layer_num++)
+				if (vactions[layer_num] == LAYER_ACTION_DRAW && is_drawn_into_target(layer_num))
+					cmd_expand_layer(ref.cmdbuf, ref, layer_num);
+
+			//the offscreen layers may be sampled by the composited ones.
+			set_memory_barrier(ref.cmdbuf,
+				VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+				VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+			cmd_set_viewport(ref.cmdbuf, 0, 0, info.Width, info.Height);
+			set_image_memory_barrier(ref.cmdbuf, target.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+			cmd_clear_image(ref.cmdbuf, target.image, 0, 0, 0, 0);
+			cmd_begin_render_pass(ref.cmdbuf, render_pass, target.framebuffer, info.Width, info.Height);
+			for (uint32_t layer_num = 0 ; layer_num < ref.layers.size(); layer_num++)
+				if (vactions[layer_num] == LAYER_ACTION_DRAW && is_drawn_into_target(layer_num))
+					cmd_draw_layer(ref.cmdbuf, ref, layer_num);
+			cmd_end_render_pass(ref.cmdbuf);
+		}
+		vkEndCommandBuffer(ref.cmdbuf);
+		ref.vlayer_actions = vactions;
+		cmdbuf_record_count++;
+	}
+
+	//ComputeComposite : the layers are sampled and scaled straight into the output image.
+	void cmd_composite(VkCommandBuffer cmdbuf, frame_info_t & ref, const swapchain_image_t & simg, VkImageLayout output_layout)
+	{
+		composite_push_t push = {};
+		push.first_layer = info.SinglePass ? info.LayerMax - 1 : 0;
+		push.layer_count = info.SinglePass ? 1 : info.LayerMax - 1;
+
+		//a LAYER_ACTION_CLEAR layer is only written by the clear, at the transfer stage.
+		set_memory_barrier(cmdbuf,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+		set_image_ownership_barrier(cmdbuf, simg.image, VK_IMAGE_ASPECT_COLOR_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, VK_ACCESS_SHADER_WRITE_BIT);
+		VkDescriptorSet vsets[] = {ref.descriptor_set_srv, simg.composite_descriptor_set};
+		vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, cp_composite);
+		vkCmdBindDescriptorSets(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, composite_pipeline_layout, 0, 2, vsets, 0, NULL);
+		vkCmdPushConstants(cmdbuf, composite_pipeline_layout, VK_SHADER_STAGE_ALL_GRAPHICS | VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+		vkCmdDispatch(cmdbuf, (info.ScreenW + 7) / 8, (info.ScreenH + 7) / 8, 1);
+
+		//present, or the copy of read_output_image.
+		set_image_ownership_barrier(cmdbuf, simg.image, VK_IMAGE_ASPECT_COLOR_BIT,
+			VK_IMAGE_LAYOUT_GENERAL, output_layout, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_MEMORY_READ_BIT);
+	}
+
+	//the final blit (or composite dispatch) of ref into one swapchain image.
+	void record_present(frame_info_t & ref, uint32_t image_index)
+	{
+		VkImageLayout output_layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		if (info.Headless)
+			output_layout = VK_IMAGE_LAYOUT_GENERAL;
+		auto cmdbuf = ref.vpresent_cmdbufs[image_index];
+		auto output_image = vswapchain_images[image_index].image;
+		auto & last_layer = ref.layers[info.LayerMax - 1];
+		vkResetCommandBuffer(cmdbuf, 0);
+		VkCommandBufferBeginInfo cmdbegininfo = {};
+		cmdbegininfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		cmdbegininfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+		vkBeginCommandBuffer(cmdbuf, &cmdbegininfo);
+		if (is_compute_composite) {
+			cmd_composite(cmdbuf, ref, vswapchain_images[image_index], output_layout);
+			vkEndCommandBuffer(cmdbuf);
+			return;
+		}
+		set_image_memory_barrier(cmdbuf, output_image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+		cmd_clear_image(cmdbuf, output_image, 0, 0, 0, 0);
+		set_image_memory_barrier(cmdbuf, last_layer.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+		set_image_memory_barrier(cmdbuf, output_image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+		cmd_blit_image(cmdbuf, output_image, last_layer.image, info.ScreenW, info.ScreenH, info.Width, info.Height);
+		set_image_memory_barrier(cmdbuf, last_layer.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+		set_image_memory_barrier(cmdbuf, output_image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, output_layout);
+		vkEndCommandBuffer(cmdbuf);
 	}
 
 	void create_cmdbuf()
 	{
-		for (int i = 0 ; i < info.FrameFifoMax; i++) {
+		for (uint32_t i = 0 ; i < vframe_infos.size(); i++) {
 			auto & ref = vframe_infos[i];
 			ref.cmdbuf = create_command_buffer(device, cmd_pool);
-			vkResetCommandBuffer(ref.cmdbuf, 0);
-			VkCommandBufferBeginInfo cmdbegininfo = {};
-			cmdbegininfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			cmdbegininfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-			vkBeginCommandBuffer(ref.cmdbuf, &cmdbegininfo);
-			for (uint32_t layer_num = 0 ; layer_num < ref.layers.size(); layer_num++) {
-				auto & layer = ref.layers[layer_num];
-				VkDeviceSize vertex_offsets[1] = {0};
-				std::vector<VkDescriptorSet> vdescriptor_sets = {
-					ref.descriptor_set_srv,
-					ref.descriptor_set_cbv,
-					layer.descriptor_set_uav,
-				};
-				vkCmdBindPipeline(ref.cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, cp_update_buffer);
-				vkCmdBindDescriptorSets(ref.cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, vdescriptor_sets.size(), vdescriptor_sets.data(), 0, NULL);
-				vkCmdDispatch(ref.cmdbuf, info.ObjectMax, 1, 1);
-
-				cmd_set_viewport(ref.cmdbuf, 0, 0, info.Width, info.Height);
-				set_image_memory_barrier(ref.cmdbuf, layer.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
-				cmd_clear_image(ref.cmdbuf, layer.image, 0, 0, 0, 0);
-				vkCmdBindPipeline(ref.cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, vgp_draw_rects[layer_num]);
-				vkCmdBindDescriptorSets(ref.cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, vdescriptor_sets.size(), vdescriptor_sets.data(), 0, NULL);
-				vkCmdBindVertexBuffers(ref.cmdbuf, 0, 1, &layer.vertex_buffer, vertex_offsets);
-				cmd_begin_render_pass(ref.cmdbuf, render_pass, layer.framebuffer, info.Width, info.Height);
-				vkCmdDrawIndirect(ref.cmdbuf, ref.indirect_draw_cmd_buffer, sizeof(VkDrawIndirectCommand) * layer_num, 1, sizeof(VkDrawIndirectCommand));
-				cmd_end_render_pass(ref.cmdbuf);
+			record_layers(ref, std::vector<uint8_t>(ref.layers.size(), LAYER_ACTION_DRAW));
+
+			//the swapchain image is only known after the acquire, so there is one blit per image.
+			ref.vpresent_cmdbufs.resize(vswapchain_images.size());
+			for (uint32_t image_index = 0 ; image_index < vswapchain_images.size(); image_index++) {
+				ref.vpresent_cmdbufs[image_index] = create_command_buffer(device, cmd_pool);
+				record_present(ref, image_index);
 			}
-			auto & last_layer = ref.layers[info.LayerMax - 1];
-			set_image_memory_barrier(ref.cmdbuf, ref.backbuffer_image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
-			cmd_clear_image(ref.cmdbuf, ref.backbuffer_image, 0, 0, 0, 0);
-			set_image_memory_barrier(ref.cmdbuf, last_layer.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-			set_image_memory_barrier(ref.cmdbuf, ref.backbuffer_image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-			cmd_blit_image(ref.cmdbuf, ref.backbuffer_image, last_layer.image, info.ScreenW, info.ScreenH, info.Width, info.Height);
-			set_image_memory_barrier(ref.cmdbuf, last_layer.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
-			set_image_memory_barrier(ref.cmdbuf, ref.backbuffer_image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
-			vkEndCommandBuffer(ref.cmdbuf);
 		}
 	}
 
 	void draw_triangles(uint32_t layer_index, uint32_t vertexCount)
 	{
 		auto & ref = vframe_infos[backbuffer_index];
-		auto & arg = ref.host_draw_indirect_cmd[layer_index];
-		arg.vertexCount = vertexCount;
-		arg.instanceCount = 1;
-		arg.firstVertex = 0;
-		arg.firstInstance = 0;
+		auto & arg = ref.host_layer_args[layer_index];
+
+		//only the live objects are expanded.
+		arg.object_count = std::min(vertexCount / 6, info.ObjectMax);
+
+		//vertexCount is written by the compute pass (or CpuExpand) after compaction.
+		arg.draw.vertexCount = 0;
+		arg.draw.instanceCount = 1;
+		arg.draw.firstVertex = 0;
+		arg.draw.firstInstance = 0;
+		if (info.DrawMode == DRAW_MODE_PULL)
+			arg.draw.vertexCount = arg.object_count * 6;
+
+		//one 4 vertex strip per object.
+		if (info.DrawMode == DRAW_MODE_INSTANCED) {
+			arg.draw.vertexCount = 4;
+			arg.draw.instanceCount = arg.object_count;
+		}
+
+		arg.dispatch.x = (arg.object_count + info.WorkgroupSize - 1) / info.WorkgroupSize;
+		arg.dispatch.y = 1;
+		arg.dispatch.z = 1;
 	}
 
 	object_format *get_object_format_address(uint32_t layer_index)
@@ -388,41 +1679,163 @@ struct vkcontext_t {
 		return (vkcontext_t::object_format *)layer.host_memory_addr;
 	}
 
+	static uint64_t get_time_ns()
+	{
+		auto now = std::chrono::steady_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+	}
+
+	//the frame FrameLatency frames back has finished, so has the last user of this slot.
+	//the object buffers and arguments of the frame may be written after this.
+	void begin_frame()
+	{
+		auto & ref = vframe_infos[backbuffer_index];
+		uint64_t start = get_time_ns();
+		if (frame_count >= info.FrameLatency) {
+			uint64_t value = frame_count + 1 - info.FrameLatency;
+			if (frame_timeline) {
+				wait_timeline_semaphore(device, frame_timeline, value);
+			} else {
+				auto & frame = vframe_infos[(value - 1) % vframe_infos.size()];
+				vkWaitForFences(device, 1, &frame.fence, VK_TRUE, UINT64_MAX);
+			}
+		}
+		vkWaitForFences(device, 1, &ref.fence, VK_TRUE, UINT64_MAX);
+		frame_stats.begin_wait_ns = get_time_ns() - start;
+		frame_stats.begin_wait_total_ns += frame_stats.begin_wait_ns;
+		reclaim_staging(ref);
+		is_frame_begun = true;
+	}
+
 	int submit()
+	{
+		return end_frame();
+	}
+
+	//without begin_frame, the wait happens here and the application may have raced the GPU.
+	int end_frame()
 	{
 		int ret = 0;
 		auto & ref = vframe_infos[backbuffer_index];
-		vkWaitForFences(device, 1, &ref.fence, VK_TRUE, UINT64_MAX);
-		vkResetFences(device, 1, &ref.fence);
-		uint32_t present_index = 0;
-
-		auto err = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, ref.sem, VK_NULL_HANDLE, &present_index);
-		if (err == VK_ERROR_OUT_OF_HOST_MEMORY)
-			printf("VK_ERROR_OUT_OF_HOST_MEMORY\n");
-		if (err == VK_ERROR_OUT_OF_DEVICE_MEMORY)
-			printf("VK_ERROR_OUT_OF_DEVICE_MEMORY\n");
-		if (err == VK_ERROR_DEVICE_LOST)
-			printf("VK_ERROR_DEVICE_LOST\n");
-		if (err == VK_ERROR_OUT_OF_DATE_KHR)
-			printf("VK_ERROR_OUT_OF_DATE_KHR\n");
-		if (err == VK_ERROR_SURFACE_LOST_KHR)
-			printf("VK_ERROR_SURFACE_LOST_KHR\n");
-		if (err == VK_ERROR_FULL_SCREEN_EXCLUSIVE_MODE_LOST_EXT)
-			printf("VK_ERROR_FULL_SCREEN_EXCLUSIVE_MODE_LOST_EXT\n");
+		if (!is_frame_begun)
+			begin_frame();
+		is_frame_begun = false;
+		flush_retained_objects(ref);
+		flush_sprite_layers();
+		destroy_retired_user_images();
+		if (is_user_image_tracked) {
+			track_user_images(ref);
+			evict_user_images();
+		}
+		update_user_image_descriptors(ref);
+
+		//the transfer queue starts on the copies while the cpu expands and waits for the swapchain.
 		std::vector<VkCommandBuffer> vcmdbuf;
-		for (auto & uimg : vuser_images) {
-			if (uimg.is_submitted == true)
-				continue;
-			vcmdbuf.push_back(uimg.transfer_cmdbuf);
-			uimg.is_submitted = true;
+		std::vector<VkSemaphore> vwait_sem;
+		std::vector<VkPipelineStageFlags> vwait_mask;
+		end_upload_cmdbuf(ref, vcmdbuf, vwait_sem, vwait_mask);
+		ref.staging_end = staging_head;
+		if (info.CpuExpand) {
+			for (uint32_t layer_num = 0 ; layer_num < ref.layers.size(); layer_num++) {
+				auto & layer = ref.layers[layer_num];
+				auto & arg = ref.host_layer_args[layer_num];
+				uint32_t count = expand_objects((const object_format *)layer.host_memory_addr, (vertex_format *)layer.host_vertex_addr, arg.object_count);
+				arg.draw.vertexCount = count * 6;
+			}
+		}
+		//headless : the offscreen target of the frame.
+		present_index = backbuffer_index % vswapchain_images.size();
+		uint64_t start = get_time_ns();
+		if (!info.Headless) {
+			auto err = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, ref.sem, VK_NULL_HANDLE, &present_index);
+			if (err == VK_ERROR_OUT_OF_HOST_MEMORY)
+				printf("VK_ERROR_OUT_OF_HOST_MEMORY\n");
+			if (err == VK_ERROR_OUT_OF_DEVICE_MEMORY)
+				printf("VK_ERROR_OUT_OF_DEVICE_MEMORY\n");
+			if (err == VK_ERROR_DEVICE_LOST)
+				printf("VK_ERROR_DEVICE_LOST\n");
+			if (err == VK_ERROR_OUT_OF_DATE_KHR)
+				printf("VK_ERROR_OUT_OF_DATE_KHR\n");
+			if (err == VK_ERROR_SURFACE_LOST_KHR)
+				printf("VK_ERROR_SURFACE_LOST_KHR\n");
+			if (err == VK_ERROR_FULL_SCREEN_EXCLUSIVE_MODE_LOST_EXT)
+				printf("VK_ERROR_FULL_SCREEN_EXCLUSIVE_MODE_LOST_EXT\n");
+			vwait_sem.push_back(ref.sem);
+			vwait_mask.push_back(VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+		}
+
+		//an image may come back while an older frame that drew into it is still running.
+		auto & simg = vswapchain_images[present_index];
+		if (simg.fence && simg.fence != ref.fence)
+			vkWaitForFences(device, 1, &simg.fence, VK_TRUE, UINT64_MAX);
+		simg.fence = ref.fence;
+		frame_stats.end_wait_ns = get_time_ns() - start;
+		frame_stats.end_wait_total_ns += frame_stats.end_wait_ns;
+
+		//the timeline reaches frame_count + 1 when this frame is done.
+		std::vector<VkSemaphore> vsignal_sem;
+		std::vector<uint64_t> vsignal_value;
+		if (frame_timeline) {
+			vsignal_sem.push_back(frame_timeline);
+			vsignal_value.push_back(frame_count + 1);
+		}
+		if (simg.render_sem) {
+			vsignal_sem.push_back(simg.render_sem);
+			if (frame_timeline)
+				vsignal_value.push_back(0);
+		}
+		if (info.DynamicCommands) {
+			auto vactions = get_layer_actions(ref);
+			if (vactions != ref.vlayer_actions)
+				record_layers(ref, vactions);
 		}
 		vcmdbuf.push_back(ref.cmdbuf);
-		submit_command(device, vcmdbuf, graphics_queue, ref.fence, ref.sem);
-		present_surface(graphics_queue, swapchain, present_index);
+		vcmdbuf.push_back(ref.vpresent_cmdbufs[present_index]);
+		submit_command(device, vcmdbuf, graphics_queue, ref.fence, vwait_sem, vwait_mask, vsignal_sem, vsignal_value);
+		if (!info.Headless)
+			present_surface(graphics_queue, swapchain, present_index, simg.render_sem);
 
 		frame_count++;
 		backbuffer_index = frame_count % vframe_infos.size();
 
 		return (ret);
 	}
+
+	VkImage get_output_image()
+	{
+		return vswapchain_images[present_index].image;
+	}
+
+	//Headless only : copy the last submitted frame into dst (RGBA8, ScreenW x ScreenH).
+	void read_output_image(std::vector<uint32_t> & dst)
+	{
+		if (!info.Headless || frame_count == 0)
+			return;
+		auto & ref = vframe_infos[(frame_count - 1) % vframe_infos.size()];
+		auto output_image = vswapchain_images[present_index].image;
+		VkDeviceSize size = info.ScreenW * info.ScreenH * sizeof(uint32_t);
+		if (readback_buffer == VK_NULL_HANDLE) {
+			readback_buffer = create_buffer(device, size);
+			alloc_readback = allocator.bind_buffer(readback_buffer, HostFlags);
+			readback_cmdbuf = create_command_buffer(device, cmd_pool);
+			readback_fence = create_fence(device);
+		}
+		vkWaitForFences(device, 1, &ref.fence, VK_TRUE, UINT64_MAX);
+
+		vkResetCommandBuffer(readback_cmdbuf, 0);
+		VkCommandBufferBeginInfo cmdbegininfo = {};
+		cmdbegininfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		cmdbegininfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(readback_cmdbuf, &cmdbegininfo);
+		set_image_memory_barrier(readback_cmdbuf, output_image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+		cmd_copy_image_to_buffer(readback_cmdbuf, readback_buffer, output_image, info.ScreenW, info.ScreenH);
+		set_image_memory_barrier(readback_cmdbuf, output_image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+		vkEndCommandBuffer(readback_cmdbuf);
+		submit_command(device, {readback_cmdbuf}, graphics_queue, readback_fence, VK_NULL_HANDLE);
+		vkWaitForFences(device, 1, &readback_fence, VK_TRUE, UINT64_MAX);
+
+		dst.resize(info.ScreenW * info.ScreenH);
+		if (alloc_readback.mapped)
+			memcpy(dst.data(), alloc_readback.mapped, size);
+	}
 };
@@ -23,15 +23,25 @@
 #pragma once
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <float.h>
+#ifdef _WIN32
 #include <windows.h>
+#endif //_WIN32
 #include <map>
 #include <vector>
 #include <string>
 #include <vector>
 #include <algorithm>
 
+#ifdef _WIN32
 #define VK_USE_PLATFORM_WIN32_KHR
+#endif //_WIN32
 #include <vulkan/vulkan.h>
+
+#ifdef _WIN32
 #include <vulkan/vk_sdk_platform.h>
 
 #pragma comment(lib, "user32.lib")
@@ -40,6 +50,12 @@
 #pragma comment(lib, "advapi32.lib")
 
 #pragma comment(lib, "vulkan-1.lib")
+#else
+//no window system : only the headless path is available.
+typedef void *HWND;
+typedef void *HINSTANCE;
+#define _countof(a) (sizeof(a) / sizeof((a)[0]))
+#endif //_WIN32
 
 #ifdef VKWIN32_DEBUG
 static VKAPI_ATTR VkBool32
@@ -89,17 +105,18 @@ bind_debug_fn(
 
 
 [[ nodiscard ]] static VkInstance
-create_instance(const char *appname)
+create_instance(const char *appname, bool is_headless = false)
 {
-	const char *vinstance_ext_names[] = {
-		VK_KHR_SURFACE_EXTENSION_NAME,
-		VK_KHR_WIN32_SURFACE_EXTENSION_NAME,
-
-
+	std::vector<const char *> vinstance_ext_names;
+	if (!is_headless) {
+		vinstance_ext_names.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+#ifdef _WIN32
+		vinstance_ext_names.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
+#endif //_WIN32
+	}
 #ifdef VKWIN32_DEBUG
-		VK_EXT_DEBUG_REPORT_EXTENSION_NAME,
+	vinstance_ext_names.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
 #endif //VKWIN32_DEBUG
-	};
 	VkInstance inst = VK_NULL_HANDLE;
 	VkApplicationInfo vkapp = {};
 	VkInstanceCreateInfo info = {};
@@ -112,12 +129,12 @@ create_instance(const char *appname)
 	vkapp.pApplicationName = appname;
 	vkapp.pEngineName = appname;
 	vkapp.applicationVersion = VK_MAKE_VERSION(0, 0, 1);
-	vkapp.apiVersion = VK_API_VERSION_1_0;
+	vkapp.apiVersion = VK_API_VERSION_1_2;
 	info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 	info.pNext = NULL;
 	info.pApplicationInfo = &vkapp;
-	info.enabledExtensionCount = (uint32_t)_countof(vinstance_ext_names);
-	info.ppEnabledExtensionNames = vinstance_ext_names;
+	info.enabledExtensionCount = (uint32_t)vinstance_ext_names.size();
+	info.ppEnabledExtensionNames = vinstance_ext_names.data();
 #ifdef VKWIN32_DEBUG
 	static const char *debuglayers[] = {
 		"VK_LAYER_KHRONOS_validation",
@@ -146,32 +163,66 @@ create_instance(const char *appname)
 
 [[ nodiscard ]]
 inline VkDevice
-create_device(VkPhysicalDevice gpudev, uint32_t graphics_queue_family_index)
+create_device(
+	VkPhysicalDevice gpudev,
+	uint32_t graphics_queue_family_index,
+	bool is_headless = false,
+	bool is_bc_enabled = false,
+	uint32_t transfer_queue_family_index = UINT32_MAX,
+	bool is_timeline_enabled = false,
+	bool is_storage_write_enabled = false,
+	bool is_update_after_bind_enabled = false,
+	bool is_storage_indexing_enabled = false)
 {
 
 	VkDevice ret = VK_NULL_HANDLE;
 	VkDeviceCreateInfo device_info = {};
-	VkDeviceQueueCreateInfo queue_info = {};
+	VkDeviceQueueCreateInfo queue_info[2] = {};
+	uint32_t queue_info_count = 1;
 	const char *ext_names[] = {
 		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
 	};
 
-	float queue_priorities[1] = {0.0};
-	queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-	queue_info.queueFamilyIndex = graphics_queue_family_index;
-	queue_info.queueCount = 1;
-	queue_info.pQueuePriorities = queue_priorities;
+	float queue_priorities[2] = {0.0, 0.0};
+	queue_info[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	queue_info[0].queueFamilyIndex = graphics_queue_family_index;
+	queue_info[0].queueCount = 1;
+	queue_info[0].pQueuePriorities = queue_priorities;
+
+	//the transfer queue is queue 1 of the graphics family, or queue 0 of its own family.
+	if (transfer_queue_family_index == graphics_queue_family_index) {
+		queue_info[0].queueCount = 2;
+	} else if (transfer_queue_family_index != UINT32_MAX) {
+		queue_info[1] = queue_info[0];
+		queue_info[1].queueFamilyIndex = transfer_queue_family_index;
+		queue_info_count = 2;
+	}
 
 	VkPhysicalDeviceDescriptorIndexingFeatures difeatures = {};
 	difeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
 	difeatures.runtimeDescriptorArray = VK_TRUE;
+	difeatures.descriptorBindingSampledImageUpdateAfterBind = is_update_after_bind_enabled;
+
+	VkPhysicalDeviceTimelineSemaphoreFeatures tsfeatures = {};
+	tsfeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+	tsfeatures.timelineSemaphore = VK_TRUE;
+	if (is_timeline_enabled)
+		difeatures.pNext = &tsfeatures;
+
+	VkPhysicalDeviceFeatures features = {};
+	features.textureCompressionBC = is_bc_enabled;
+	features.shaderStorageImageArrayDynamicIndexing = is_storage_indexing_enabled;
+	features.shaderStorageImageWriteWithoutFormat = is_storage_write_enabled;
 
 	device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	device_info.pNext = &difeatures;
-	device_info.queueCreateInfoCount = 1;
-	device_info.pQueueCreateInfos = &queue_info;
-	device_info.enabledExtensionCount = (uint32_t)_countof(ext_names);
-	device_info.ppEnabledExtensionNames = ext_names;
+	device_info.queueCreateInfoCount = queue_info_count;
+	device_info.pQueueCreateInfos = queue_info;
+	device_info.pEnabledFeatures = &features;
+	if (!is_headless) {
+		device_info.enabledExtensionCount = (uint32_t)_countof(ext_names);
+		device_info.ppEnabledExtensionNames = ext_names;
+	}
 	auto err = vkCreateDevice(gpudev, &device_info, NULL, &ret);
 
 	return (ret);
@@ -197,6 +248,79 @@ get_graphics_queue_index(VkPhysicalDevice gpudev)
 	return (ret);
 }
 
+[[ nodiscard ]]
+inline bool
+is_timeline_semaphore_supported(VkPhysicalDevice gpudev)
+{
+	VkPhysicalDeviceTimelineSemaphoreFeatures tsfeatures = {};
+	VkPhysicalDeviceFeatures2 features = {};
+
+	tsfeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	features.pNext = &tsfeatures;
+	vkGetPhysicalDeviceFeatures2(gpudev, &features);
+
+	return (tsfeatures.timelineSemaphore == VK_TRUE);
+}
+
+[[ nodiscard ]]
+inline bool
+is_update_after_bind_supported(VkPhysicalDevice gpudev)
+{
+	VkPhysicalDeviceDescriptorIndexingFeatures difeatures = {};
+	VkPhysicalDeviceFeatures2 features = {};
+
+	difeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	features.pNext = &difeatures;
+	vkGetPhysicalDeviceFeatures2(gpudev, &features);
+
+	return (difeatures.descriptorBindingSampledImageUpdateAfterBind == VK_TRUE);
+}
+
+[[ nodiscard ]]
+inline bool
+is_present_mode_supported(VkPhysicalDevice gpudev, VkSurfaceKHR surface, VkPresentModeKHR present_mode)
+{
+	uint32_t cnt = 0;
+	vkGetPhysicalDeviceSurfacePresentModesKHR(gpudev, surface, &cnt, nullptr);
+	std::vector<VkPresentModeKHR> temp(cnt);
+	vkGetPhysicalDeviceSurfacePresentModesKHR(gpudev, surface, &cnt, temp.data());
+	for (auto mode : temp)
+		if (mode == present_mode)
+			return (true);
+
+	return (false);
+}
+
+//a family without graphics and compute is the DMA engine, else any other family,
+//else a second queue of the graphics family. UINT32_MAX : none.
+[[ nodiscard ]]
+inline uint32_t
+get_transfer_queue_index(VkPhysicalDevice gpudev, uint32_t graphics_queue_family_index)
+{
+	uint32_t ret = UINT32_MAX;
+	uint32_t cnt = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(gpudev, &cnt, nullptr);
+	std::vector<VkQueueFamilyProperties> temp(cnt);
+	vkGetPhysicalDeviceQueueFamilyProperties(gpudev, &cnt, temp.data());
+	VkQueueFlags copy_flags = VK_QUEUE_TRANSFER_BIT | VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
+	for (uint32_t i = 0; i < cnt && ret == UINT32_MAX; i++) {
+		auto flags = temp[i].queueFlags;
+		if (i != graphics_queue_family_index && (flags & copy_flags) == VK_QUEUE_TRANSFER_BIT)
+			ret = i;
+	}
+	for (uint32_t i = 0; i < cnt && ret == UINT32_MAX; i++) {
+		auto flags = temp[i].queueFlags;
+		if (i != graphics_queue_family_index && (flags & copy_flags))
+			ret = i;
+	}
+	if (ret == UINT32_MAX && temp[graphics_queue_family_index].queueCount > 1)
+		ret = graphics_queue_family_index;
+
+	return (ret);
+}
+
 [[ nodiscard ]]
 inline uint32_t
 get_buffer_memreq_size(VkDevice device, VkBuffer buffer)
@@ -288,13 +412,31 @@ create_command_buffer(VkDevice device, VkCommandPool cmd_pool)
 	return (ret);
 }
 
+[[ nodiscard ]]
+inline uint32_t
+find_memory_type_index(
+	const VkPhysicalDeviceMemoryProperties & devprop,
+	uint32_t memory_type_bits,
+	VkMemoryPropertyFlags flags)
+{
+	for (uint32_t i = 0; i < devprop.memoryTypeCount; i++) {
+		if ((memory_type_bits & (1 << i)) == 0)
+			continue;
+		if ((devprop.memoryTypes[i].propertyFlags & flags) == flags)
+			return (i);
+	}
+
+	return (UINT32_MAX);
+}
+
 [[ nodiscard ]]
 inline VkDeviceMemory
 alloc_device_memory(
 	VkPhysicalDevice gpudev,
 	VkDevice device,
 	VkDeviceSize size,
-	bool is_host)
+	bool is_host,
+	uint32_t memory_type_bits = UINT32_MAX)
 {
 	VkDeviceMemory ret = VK_NULL_HANDLE;
 	VkMemoryAllocateInfo ma_info = {};
@@ -309,12 +451,9 @@ alloc_device_memory(
 		flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
 			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
 	}
-	for (uint32_t i = 0; i < devprop.memoryTypeCount; i++) {
-		if ((devprop.memoryTypes[i].propertyFlags & flags) == flags) {
-			ma_info.memoryTypeIndex = i;
-			break;
-		}
-	}
+	ma_info.memoryTypeIndex = find_memory_type_index(devprop, memory_type_bits, flags);
+	if (ma_info.memoryTypeIndex == UINT32_MAX)
+		return VK_NULL_HANDLE;
 	vkAllocateMemory(device, &ma_info, nullptr, &ret);
 
 	return (ret);
@@ -333,6 +472,36 @@ create_semaphore(VkDevice device)
 	return (ret);
 }
 
+[[ nodiscard ]]
+inline VkSemaphore
+create_timeline_semaphore(VkDevice device, uint64_t initial_value = 0)
+{
+	VkSemaphore ret = VK_NULL_HANDLE;
+	VkSemaphoreTypeCreateInfo type_info = {};
+	VkSemaphoreCreateInfo info = {};
+
+	type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	type_info.initialValue = initial_value;
+	info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	info.pNext = &type_info;
+	vkCreateSemaphore(device, &info, nullptr, &ret);
+
+	return (ret);
+}
+
+inline void
+wait_timeline_semaphore(VkDevice device, VkSemaphore sem, uint64_t value)
+{
+	VkSemaphoreWaitInfo info = {};
+
+	info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	info.semaphoreCount = 1;
+	info.pSemaphores = &sem;
+	info.pValues = &value;
+	vkWaitSemaphores(device, &info, UINT64_MAX);
+}
+
 
 [[ nodiscard ]]
 inline VkFence
@@ -348,6 +517,7 @@ create_fence(VkDevice device)
 	return (ret);
 }
 
+#ifdef _WIN32
 [[ nodiscard ]]
 inline VkSurfaceKHR
 create_win32_surface(VkInstance inst, HWND hwnd, HINSTANCE hinst)
@@ -362,6 +532,7 @@ create_win32_surface(VkInstance inst, HWND hwnd, HINSTANCE hinst)
 
 	return (ret);
 }
+#endif //_WIN32
 
 [[ nodiscard ]]
 inline VkSwapchainKHR
@@ -369,7 +540,9 @@ create_swapchain(
 	VkDevice device,
 	VkSurfaceKHR surface,
 	uint32_t width, uint32_t height,
-	uint32_t fifomax)
+	uint32_t fifomax,
+	VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR,
+	VkImageUsageFlags extra_usage = 0)
 {
 	VkSwapchainKHR ret = VK_NULL_HANDLE;
 	VkSwapchainCreateInfoKHR info = {};
@@ -383,13 +556,12 @@ create_swapchain(
 	info.imageExtent.height = height;
 	info.imageArrayLayers = 1;
 	info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
-		VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		VK_IMAGE_USAGE_TRANSFER_DST_BIT | extra_usage;
 	info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	info.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
 	info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 
-	info.presentMode = VK_PRESENT_MODE_FIFO_KHR;
-	//info.presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+	info.presentMode = present_mode;
 
 	info.clipped = VK_TRUE;
 	vkCreateSwapchainKHR(device, &info, nullptr, &ret);
@@ -412,9 +584,11 @@ submit_command(
 	VkSemaphore waitSemaphores[] = { sem };
 
 	info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	info.pWaitDstStageMask = wait_mask;
-	info.waitSemaphoreCount = 1;
-	info.pWaitSemaphores = waitSemaphores;
+	if (sem) {
+		info.pWaitDstStageMask = wait_mask;
+		info.waitSemaphoreCount = 1;
+		info.pWaitSemaphores = waitSemaphores;
+	}
 	info.pCommandBuffers = vcmdbuf.data();
 	info.commandBufferCount = vcmdbuf.size();
 	info.signalSemaphoreCount = 0;
@@ -423,15 +597,56 @@ submit_command(
 	vkQueueSubmit(queue, 1, &info, fence);
 }
 
+inline void
+submit_command(
+	VkDevice device,
+	std::vector<VkCommandBuffer> vcmdbuf,
+	VkQueue queue,
+	VkFence fence,
+	std::vector<VkSemaphore> vwait_sem,
+	std::vector<VkPipelineStageFlags> vwait_mask,
+	std::vector<VkSemaphore> vsignal_sem,
+	std::vector<uint64_t> vsignal_value = {})
+{
+	VkSubmitInfo info = {};
+	VkTimelineSemaphoreSubmitInfo timeline_info = {};
+
+	//one value per signal semaphore, the binary ones ignore theirs.
+	if (!vsignal_value.empty()) {
+		timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timeline_info.signalSemaphoreValueCount = vsignal_value.size();
+		timeline_info.pSignalSemaphoreValues = vsignal_value.data();
+		info.pNext = &timeline_info;
+	}
+
+	info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	info.pWaitDstStageMask = vwait_mask.data();
+	info.waitSemaphoreCount = vwait_sem.size();
+	info.pWaitSemaphores = vwait_sem.data();
+	info.pCommandBuffers = vcmdbuf.data();
+	info.commandBufferCount = vcmdbuf.size();
+	info.signalSemaphoreCount = vsignal_sem.size();
+	info.pSignalSemaphores = vsignal_sem.data();
+
+	if (fence)
+		vkResetFences(device, 1, &fence);
+	vkQueueSubmit(queue, 1, &info, fence);
+}
+
 inline void
 present_surface(
 	VkQueue queue,
 	VkSwapchainKHR swapchain,
-	uint32_t present_index)
+	uint32_t present_index,
+	VkSemaphore wait_sem = VK_NULL_HANDLE)
 {
 	VkPresentInfoKHR info = {};
 
 	info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+	if (wait_sem) {
+		info.waitSemaphoreCount = 1;
+		info.pWaitSemaphores = &wait_sem;
+	}
 	info.pSwapchains = &swapchain;
 	info.swapchainCount = 1;
 	info.pImageIndices = &present_index;
@@ -470,6 +685,64 @@ set_image_memory_barrier(
 		0, 0, NULL, 0, NULL, 1, &ret);
 }
 
+//release (on the src family) or acquire (on the dst family) half of a queue family ownership transfer.
+//with VK_QUEUE_FAMILY_IGNORED for both, a layout transition with explicit stages.
+[[ nodiscard ]]
+inline void
+set_image_ownership_barrier(
+	VkCommandBuffer cmdbuf,
+	VkImage image,
+	VkImageAspectFlags aspectMask,
+	VkImageLayout old_image_layout,
+	VkImageLayout new_image_layout,
+	uint32_t src_queue_family_index,
+	uint32_t dst_queue_family_index,
+	VkPipelineStageFlags src_stage,
+	VkPipelineStageFlags dst_stage,
+	VkAccessFlags src_access,
+	VkAccessFlags dst_access)
+{
+	VkImageMemoryBarrier ret = {};
+
+	ret.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	ret.image = image;
+	ret.oldLayout = old_image_layout;
+	ret.newLayout = new_image_layout;
+	ret.srcQueueFamilyIndex = src_queue_family_index;
+	ret.dstQueueFamilyIndex = dst_queue_family_index;
+	ret.srcAccessMask = src_access;
+	ret.dstAccessMask = dst_access;
+	ret.subresourceRange = {
+		aspectMask,
+		0, 1,
+		0, 1
+	};
+	vkCmdPipelineBarrier(cmdbuf,
+		src_stage,
+		dst_stage,
+		0, 0, NULL, 0, NULL, 1, &ret);
+}
+
+[[ nodiscard ]]
+inline void
+set_memory_barrier(
+	VkCommandBuffer cmdbuf,
+	VkPipelineStageFlags src_stage,
+	VkPipelineStageFlags dst_stage,
+	VkAccessFlags src_access,
+	VkAccessFlags dst_access)
+{
+	VkMemoryBarrier ret = {};
+
+	ret.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	ret.srcAccessMask = src_access;
+	ret.dstAccessMask = dst_access;
+	vkCmdPipelineBarrier(cmdbuf,
+		src_stage,
+		dst_stage,
+		0, 1, &ret, 0, NULL, 0, NULL);
+}
+
 [[ nodiscard ]]
 inline VkBuffer
 create_buffer(
@@ -505,7 +778,8 @@ create_image(
 	uint32_t height,
 	VkFormat format,
 	VkImageUsageFlags usageFlags,
-	VkImageCreateInfo *pinfo = nullptr)
+	VkImageCreateInfo *pinfo = nullptr,
+	uint32_t mip_levels = 1)
 {
 	VkImage ret = VK_NULL_HANDLE;
 	VkImageCreateInfo info = {};
@@ -516,7 +790,7 @@ create_image(
 	info.extent.width = width;
 	info.extent.height = height;
 	info.extent.depth = 1;
-	info.mipLevels = 1;
+	info.mipLevels = mip_levels;
 	info.arrayLayers = 1;
 	info.samples = VK_SAMPLE_COUNT_1_BIT;
 	info.tiling = VK_IMAGE_TILING_OPTIMAL;
@@ -539,7 +813,9 @@ create_image_view(
 	VkImage image,
 	VkFormat format,
 	VkImageAspectFlags aspectMask,
-	VkImageViewCreateInfo *pinfo = nullptr)
+	VkImageViewCreateInfo *pinfo = nullptr,
+	uint32_t base_mip_level = 0,
+	uint32_t level_count = 1)
 {
 	VkImageView ret = VK_NULL_HANDLE;
 	VkImageViewCreateInfo info = {};
@@ -553,7 +829,8 @@ create_image_view(
 	info.components.b = VK_COMPONENT_SWIZZLE_B;
 	info.components.a = VK_COMPONENT_SWIZZLE_A;
 	info.subresourceRange.aspectMask = aspectMask;
-	info.subresourceRange.levelCount = 1;
+	info.subresourceRange.baseMipLevel = base_mip_level;
+	info.subresourceRange.levelCount = level_count;
 	info.subresourceRange.layerCount = 1;
 	vkCreateImageView(device, &info, NULL, &ret);
 
@@ -642,7 +919,8 @@ create_framebuffer(
 [[ nodiscard ]]
 inline VkDescriptorPool
 create_descriptor_pool(
-	VkDevice device, uint32_t cnt, uint32_t max_sets = 0xFF)
+	VkDevice device, uint32_t cnt, uint32_t max_sets = 0xFF,
+	VkDescriptorPoolCreateFlags flags = 0)
 {
 	VkDescriptorPool ret = nullptr;
 	VkDescriptorPoolCreateInfo info = {};
@@ -662,7 +940,7 @@ create_descriptor_pool(
 
 	info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	info.pNext = nullptr;
-	info.flags = 0;
+	info.flags = flags;
 	info.maxSets = max_sets;
 	info.poolSizeCount = (uint32_t)vpoolsizes.size();
 	info.pPoolSizes = vpoolsizes.data();
@@ -675,12 +953,23 @@ create_descriptor_pool(
 inline VkDescriptorSetLayout
 create_descriptor_set_layout(
 	VkDevice device,
-	std::vector<VkDescriptorSetLayoutBinding> & vdesc_setlayout_binding)
+	std::vector<VkDescriptorSetLayoutBinding> & vdesc_setlayout_binding,
+	const std::vector<VkDescriptorBindingFlags> & vbinding_flags = {})
 {
 	VkDescriptorSetLayout ret = nullptr;
 	VkDescriptorSetLayoutCreateInfo info = {};
+	VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info = {};
 
 	info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	if (!vbinding_flags.empty()) {
+		flags_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+		flags_info.bindingCount = (uint32_t)vbinding_flags.size();
+		flags_info.pBindingFlags = vbinding_flags.data();
+		info.pNext = &flags_info;
+		for (auto flags : vbinding_flags)
+			if (flags & VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT)
+				info.flags |= VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+	}
 	info.pBindings = vdesc_setlayout_binding.data();
 	info.bindingCount = (uint32_t)vdesc_setlayout_binding.size();
 	auto err = vkCreateDescriptorSetLayout(device, &info, nullptr, &ret);
@@ -693,14 +982,22 @@ inline VkPipelineLayout
 create_pipeline_layout(
 	VkDevice device,
 	VkDescriptorSetLayout *descriptor_layouts,
-	size_t count)
+	size_t count,
+	uint32_t push_constant_size = 0)
 {
 	VkPipelineLayout ret = nullptr;
 	VkPipelineLayoutCreateInfo info = {};
+	VkPushConstantRange push_constant_range = {};
 
 	info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	info.setLayoutCount = count;
 	info.pSetLayouts = descriptor_layouts;
+	if (push_constant_size) {
+		push_constant_range.stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS | VK_SHADER_STAGE_COMPUTE_BIT;
+		push_constant_range.size = push_constant_size;
+		info.pushConstantRangeCount = 1;
+		info.pPushConstantRanges = &push_constant_range;
+	}
 	auto err = vkCreatePipelineLayout(device, &info, NULL, &ret);
 
 	return (ret);
@@ -742,15 +1039,37 @@ create_shader_module(
 	return (ret);
 }
 
+//constant_id N takes spec_constants[N], nullptr if there is none.
+inline const VkSpecializationInfo *
+setup_specialization_info(
+	const std::vector<uint32_t> & spec_constants,
+	std::vector<VkSpecializationMapEntry> & vspec_entries,
+	VkSpecializationInfo & spec_info)
+{
+	if (spec_constants.empty())
+		return nullptr;
+	for (uint32_t i = 0 ; i < spec_constants.size(); i++)
+		vspec_entries.push_back({i, uint32_t(i * sizeof(uint32_t)), sizeof(uint32_t)});
+	spec_info.mapEntryCount = vspec_entries.size();
+	spec_info.pMapEntries = vspec_entries.data();
+	spec_info.dataSize = spec_constants.size() * sizeof(uint32_t);
+	spec_info.pData = spec_constants.data();
+
+	return (&spec_info);
+}
+
 [[ nodiscard ]]
 inline VkPipeline
 create_cpipeline(
 	VkDevice device,
 	VkPipelineLayout pipeline_layout,
-	std::vector<uint8_t> & cs)
+	std::vector<uint8_t> & cs,
+	const std::vector<uint32_t> & spec_constants = {})
 {
 	VkPipeline ret = nullptr;
 	VkComputePipelineCreateInfo info = {};
+	VkSpecializationInfo spec_info = {};
+	std::vector<VkSpecializationMapEntry> vspec_entries;
 	std::vector<VkShaderModule> vshadermodules;
 
 	if (cs.empty())
@@ -762,6 +1081,7 @@ create_cpipeline(
 	info.stage.pName = "main";
 	info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
 	info.stage.module = module;
+	info.stage.pSpecializationInfo = setup_specialization_info(spec_constants, vspec_entries, spec_info);
 	info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
 	info.layout = pipeline_layout;
 	vkCreateComputePipelines(device, nullptr, 1, &info, nullptr, &ret);
@@ -772,6 +1092,29 @@ create_cpipeline(
 	return (ret);
 }
 
+inline uint32_t
+get_vertex_attribute_size(VkFormat format)
+{
+	switch (format) {
+	case VK_FORMAT_R16_UINT:
+		return 2;
+	case VK_FORMAT_R16G16_SFLOAT:
+	case VK_FORMAT_R16G16_UNORM:
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R32_UINT:
+		return 4;
+	case VK_FORMAT_R32G32_SFLOAT:
+		return 8;
+	case VK_FORMAT_R32G32B32A32_SFLOAT:
+	case VK_FORMAT_R32G32B32A32_UINT:
+		return 16;
+	default:
+		break;
+	}
+	printf("unsupported vertex attribute format %d\n", format);
+	return 0;
+}
+
 [[ nodiscard ]]
 inline VkPipeline
 create_gpipeline(
@@ -779,9 +1122,23 @@ create_gpipeline(
 	VkPipelineLayout pipeline_layout,
 	VkRenderPass render_pass,
 	std::vector<uint8_t> & vs,
-	std::vector<uint8_t> & ps)
+	std::vector<uint8_t> & ps,
+	const std::vector<VkFormat> & vattr_formats = {
+		VK_FORMAT_R32G32B32A32_SFLOAT,
+		VK_FORMAT_R32G32B32A32_SFLOAT,
+		VK_FORMAT_R32G32B32A32_SFLOAT,
+		VK_FORMAT_R32G32B32A32_UINT,
+	},
+	uint32_t vertex_stride = 0,
+	VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+	const std::vector<uint32_t> & vs_spec_constants = {},
+	const std::vector<uint32_t> & ps_spec_constants = {})
 {
 	VkPipeline ret = nullptr;
+	VkSpecializationInfo vs_spec_info = {};
+	VkSpecializationInfo ps_spec_info = {};
+	std::vector<VkSpecializationMapEntry> vvs_spec_entries;
+	std::vector<VkSpecializationMapEntry> vps_spec_entries;
 	VkPipelineCacheCreateInfo pipelineCache = {};
 	VkPipelineVertexInputStateCreateInfo vi = {};
 	VkPipelineInputAssemblyStateCreateInfo ia = {};
@@ -863,7 +1220,9 @@ create_gpipeline(
 		vshadermodules.push_back(module);
 		sstage.stage = VK_SHADER_STAGE_VERTEX_BIT;
 		sstage.module = module;
+		sstage.pSpecializationInfo = setup_specialization_info(vs_spec_constants, vvs_spec_entries, vs_spec_info);
 		vsstageinfo.push_back(sstage);
+		sstage.pSpecializationInfo = nullptr;
 	}
 	if (!ps.empty()) {
 		auto module = create_shader_module(
@@ -871,34 +1230,36 @@ create_gpipeline(
 		vshadermodules.push_back(module);
 		sstage.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
 		sstage.module = module;
+		sstage.pSpecializationInfo = setup_specialization_info(ps_spec_constants, vps_spec_entries, ps_spec_info);
 		vsstageinfo.push_back(sstage);
 	}
 
-	//SETUP IA
+	//SETUP IA : attributes are tightly packed, location = index.
 	uint32_t stride_size = 0;
 	std::vector<VkVertexInputAttributeDescription> via_desc;
-	via_desc.push_back({0, 0, VK_FORMAT_R32G32B32A32_SFLOAT, stride_size});
-	stride_size += sizeof(float) * 4;
-	via_desc.push_back({1, 0, VK_FORMAT_R32G32B32A32_SFLOAT, stride_size});
-	stride_size += sizeof(float) * 4;
-	via_desc.push_back({2, 0, VK_FORMAT_R32G32B32A32_SFLOAT, stride_size});
-	stride_size += sizeof(float) * 4;
-	via_desc.push_back({3, 0, VK_FORMAT_R32G32B32A32_UINT , stride_size});
-	stride_size += sizeof(uint32_t) * 4;
+	for (uint32_t i = 0 ; i < vattr_formats.size(); i++) {
+		via_desc.push_back({i, 0, vattr_formats[i], stride_size});
+		stride_size += get_vertex_attribute_size(vattr_formats[i]);
+	}
+	if (vertex_stride)
+		stride_size = vertex_stride;
 
 	ia.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-	ia.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	ia.topology = topology;
 
 	VkVertexInputBindingDescription vi_ibdesc = {};
 	vi_ibdesc.binding = 0;
 	vi_ibdesc.stride = stride_size;
 	vi_ibdesc.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
+	//vertex pulling shaders have no vertex input.
 	vi.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vi.vertexBindingDescriptionCount = 1;
-	vi.pVertexBindingDescriptions = &vi_ibdesc;
-	vi.vertexAttributeDescriptionCount = via_desc.size();
-	vi.pVertexAttributeDescriptions = via_desc.data();
+	if (!via_desc.empty()) {
+		vi.vertexBindingDescriptionCount = 1;
+		vi.pVertexBindingDescriptions = &vi_ibdesc;
+		vi.vertexAttributeDescriptionCount = via_desc.size();
+		vi.pVertexAttributeDescriptions = via_desc.data();
+	}
 
 	VkGraphicsPipelineCreateInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
@@ -987,6 +1348,21 @@ update_descriptor_combined_image_sample(
 		binding, index, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 }
 
+inline void
+update_descriptor_storage_image(
+	VkDevice device,
+	VkDescriptorSet dset,
+	uint32_t binding,
+	uint32_t index,
+	VkImageView image_view)
+{
+	VkDescriptorImageInfo info = {};
+	info.imageView = image_view;
+	info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+	update_descriptor_sets(device, dset, &info,
+		binding, index, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+}
+
 inline void
 update_descriptor_storage_buffer(
 	VkDevice device,
@@ -1068,6 +1444,26 @@ cmd_end_render_pass(
 	vkCmdEndRenderPass(cmdbuf);
 }
 
+inline void
+cmd_copy_image_to_buffer(
+	VkCommandBuffer cmdbuf,
+	VkBuffer dst,
+	VkImage src,
+	uint32_t width, uint32_t height)
+{
+	VkBufferImageCopy copy_region = {};
+
+	copy_region.bufferOffset = 0;
+	copy_region.bufferRowLength = width;
+	copy_region.bufferImageHeight = height;
+	copy_region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+	copy_region.imageOffset = {0, 0, 0};
+	copy_region.imageExtent = {width, height, 1};
+	vkCmdCopyImageToBuffer(cmdbuf,
+		src, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		dst, 1, &copy_region);
+}
+
 inline void
 cmd_blit_image(
 	VkCommandBuffer cmdbuf,